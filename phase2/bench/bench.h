@@ -0,0 +1,12 @@
+/*
+ * Shared helpers for the phase 2 benchmarks in this directory.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+// prints one result line: ops, ops per simulated second, and simulated
+// microseconds per op, for the interval [start, end] of currentTime()
+extern void benchReport(char *name, int ops, int start, int end);
+
+#endif
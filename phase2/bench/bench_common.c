@@ -0,0 +1,23 @@
+
+/* Shared reporting for the benchmarks.  All times are simulated
+ * microseconds from currentTime(), so "us/op" is the simulator's notion of
+ * cycles per operation.
+ */
+
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+#include "bench.h"
+
+
+
+void benchReport(char *name, int ops, int start, int end)
+{
+    int    elapsed = end - start;
+    double opsPerSec = elapsed > 0 ? ops * 1000000.0 / elapsed : 0;
+    double usPerOp = ops > 0 ? (double)elapsed / ops : 0;
+
+    USLOSS_Console("%-24s %8d ops %10d us %12.0f ops/s %8.3f us/op\n",
+                   name, ops, elapsed, opsPerSec, usPerOp);
+}
@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Compares benchmark output against a baseline and flags regressions.
+#
+#     bench_compare.sh BASELINE RESULTS [THRESHOLD [UNGATED]]
+#
+# Both files hold benchReport() lines, usually from several runs of the
+# suite.  A scenario's cost is its best (lowest) us/op over the runs, since
+# load from elsewhere only ever makes a run slower.  The slowest baseline
+# run gives the spread between runs of the same code, so a scenario only
+# regresses when its best cost exceeds both the slowest baseline run and
+# the best baseline run plus THRESHOLD percent (default 25).  UNGATED is a
+# comma-separated list of scenarios that are reported but never fail, for
+# those whose time is mostly spent spinning rather than in the kernel.
+# Lines that are not benchmark results are ignored, as are scenarios that
+# appear in only one of the files.  Exits 1 if anything regressed.
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 BASELINE RESULTS [THRESHOLD [UNGATED]]" >&2
+    exit 2
+fi
+
+if [ ! -f "$1" ]; then
+    echo "$0: no baseline $1; run 'make bench-baseline' first" >&2
+    exit 2
+fi
+
+awk -v threshold="${3:-25}" -v ungated="$4" '
+    BEGIN {
+        n = split(ungated, list, ",")
+        for (i = 1; i <= n; i++)
+            skip[list[i]] = 1
+    }
+    # name is everything before the op count; us/op is the next-to-last field
+    $NF != "us/op" { next }
+    {
+        name = $1
+        for (i = 2; i <= NF - 8; i++)
+            name = name " " $i
+        cost = $(NF - 1)
+    }
+    FNR == NR {
+        if (!(name in best) || cost < best[name])
+            best[name] = cost
+        if (!(name in worst) || cost > worst[name])
+            worst[name] = cost
+        next
+    }
+    !(name in best) { next }
+    !(name in result) { order[++count] = name }
+    !(name in result) || cost < result[name] { result[name] = cost }
+    END {
+        for (i = 1; i <= count; i++) {
+            name = order[i]
+            limit = best[name] * (1 + threshold / 100.0)
+            if (limit < worst[name])
+                limit = worst[name]
+            if (name in skip)
+                status = "ungated"
+            else if (result[name] > limit && result[name] - best[name] >= 0.001) {
+                status = "REGRESSED"
+                failed++
+            } else
+                status = "ok"
+            printf "%-24s %10.3f -> %10.3f us/op  (limit %.3f)  %s\n",
+                   name, best[name], result[name], limit, status
+        }
+        if (failed) {
+            printf "%d scenario(s) regressed by more than %s%% and the baseline spread\n",
+                   failed, threshold
+            exit 1
+        }
+    }
+' "$1" "$2"
@@ -0,0 +1,442 @@
+
+/* Mailbox microbenchmarks.  Each scenario runs a fixed number of mailbox
+ * operations and reports throughput and simulated microseconds per op:
+ *
+ *   pingpong   two processes bounce a message through zero-slot mailboxes
+ *   fan-in     NPROCS producers send to one mailbox, start2 receives
+ *   fan-out    start2 sends to one mailbox, NPROCS consumers receive
+ *   full-box   three senders at priorities 4, 3, 2 stay blocked on a full
+ *              5-slot mailbox while a priority 5 receiver drains it
+ *              (the shape of test26)
+ *   condsend   MboxCondSend until the box is full, MboxCondRecv until it
+ *              is empty, no blocking at all
+ *   release    MboxRelease of a mailbox with NPROCS blocked receivers
+ *   inversion  a priority 2 sender waits on a zero-slot mailbox for a
+ *              priority 5 receiver while a priority 3 process burns CPU;
+ *              also prints the time the sender spent inverted, which
+ *              priority inheritance (PHASE2_PRIORITY_INHERIT) shrinks
+ *              where phase 1 supports it (the host build)
+ *   pipeline   full-size messages pass through PIPE_BOXES mailboxes; the
+ *              stages in between either receive and re-send each message
+ *              (pipe-copy) or move it with MboxForward (pipe-forward)
+ *   recv       start2 fills a 50-slot mailbox with full-size messages and
+ *              drains it, copying each one out (recv-copy) or borrowing
+ *              it with MboxRecvLoan (recv-loan)
+ *   send-ref   the same with REF_BYTES buffers passed by MboxSendRef and
+ *              MboxRecvRef, which cost the same whatever their size
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+#include "bench.h"
+
+#define ITERATIONS      10000
+#define NPROCS          8
+#define RELEASE_ROUNDS  100
+#define INVERSION_ROUNDS 100
+#define HOG_SPIN        20000
+#define PIPE_BOXES      4
+#define REF_BYTES       65536
+
+int Echo(char *);
+int Producer(char *);
+int Consumer(char *);
+int FullSender(char *);
+int FullReceiver(char *);
+int ReleaseDriver(char *);
+int ReleaseWaiter(char *);
+int InvSender(char *);
+int InvReceiver(char *);
+int InvHog(char *);
+int PipeStage(char *);
+int PipeSink(char *);
+
+int mbox_a, mbox_b;
+int hog_sem;
+int pipe_boxes[PIPE_BOXES];
+int pipe_forward;
+char pipe_args[PIPE_BOXES - 1][2] = { "0", "1", "2" };
+char msg[] = "benchmark message";
+char ref_buf[REF_BYTES];
+
+
+
+static void pingpong(void)
+{
+    int i, start, status;
+    char buf[MAX_MESSAGE];
+
+    mbox_a = MboxCreate(0, MAX_MESSAGE);
+    mbox_b = MboxCreate(0, MAX_MESSAGE);
+    fork1("Echo", Echo, NULL, 2 * USLOSS_MIN_STACK, 1);
+
+    start = currentTime();
+    for (i = 0; i < ITERATIONS; i++) {
+        MboxSend(mbox_a, msg, sizeof(msg));
+        MboxRecv(mbox_b, buf, sizeof(buf));
+    }
+    benchReport("pingpong", 2 * ITERATIONS, start, currentTime());
+
+    join(&status);
+    MboxRelease(mbox_a);
+    MboxRelease(mbox_b);
+}
+
+static void fanIn(void)
+{
+    int i, start, status;
+    char buf[MAX_MESSAGE];
+
+    mbox_a = MboxCreate(10, MAX_MESSAGE);
+
+    start = currentTime();
+    for (i = 0; i < NPROCS; i++)
+        fork1("Producer", Producer, NULL, 2 * USLOSS_MIN_STACK, 2);
+    for (i = 0; i < ITERATIONS; i++)
+        MboxRecv(mbox_a, buf, sizeof(buf));
+    for (i = 0; i < NPROCS; i++)
+        join(&status);
+    benchReport("fan-in", 2 * ITERATIONS, start, currentTime());
+
+    MboxRelease(mbox_a);
+}
+
+static void fanOut(void)
+{
+    int i, start, status;
+
+    mbox_a = MboxCreate(10, MAX_MESSAGE);
+
+    start = currentTime();
+    for (i = 0; i < NPROCS; i++)
+        fork1("Consumer", Consumer, NULL, 2 * USLOSS_MIN_STACK, 2);
+    for (i = 0; i < ITERATIONS; i++)
+        MboxSend(mbox_a, msg, sizeof(msg));
+    for (i = 0; i < NPROCS; i++)
+        join(&status);
+    benchReport("fan-out", 2 * ITERATIONS, start, currentTime());
+
+    MboxRelease(mbox_a);
+}
+
+static void fullBox(void)
+{
+    int i, start, status;
+
+    mbox_a = MboxCreate(5, MAX_MESSAGE);
+
+    start = currentTime();
+    fork1("FullSender", FullSender, NULL, 2 * USLOSS_MIN_STACK, 4);
+    fork1("FullSender", FullSender, NULL, 2 * USLOSS_MIN_STACK, 3);
+    fork1("FullSender", FullSender, NULL, 2 * USLOSS_MIN_STACK, 2);
+    fork1("FullReceiver", FullReceiver, NULL, 2 * USLOSS_MIN_STACK, 5);
+    for (i = 0; i < 4; i++)
+        join(&status);
+    benchReport("full-box", 2 * 3 * (ITERATIONS / 3), start, currentTime());
+
+    MboxRelease(mbox_a);
+}
+
+static void condSend(void)
+{
+    int i, ops, start;
+    char buf[MAX_MESSAGE];
+
+    mbox_a = MboxCreate(50, MAX_MESSAGE);
+
+    ops = 0;
+    start = currentTime();
+    for (i = 0; i < ITERATIONS / 50; i++) {
+        do {
+            ops++;
+        } while (MboxCondSend(mbox_a, msg, sizeof(msg)) == 0);
+        do {
+            ops++;
+        } while (MboxCondRecv(mbox_a, buf, sizeof(buf)) >= 0);
+    }
+    benchReport("condsend", ops, start, currentTime());
+
+    MboxRelease(mbox_a);
+}
+
+static void release(void)
+{
+    int start, status;
+
+    /* start2 runs at priority 1, so the waiters could never block before
+     * the release; a low-priority driver does the forking instead.
+     */
+    start = currentTime();
+    fork1("ReleaseDriver", ReleaseDriver, NULL, 2 * USLOSS_MIN_STACK, 5);
+    join(&status);
+    benchReport("release", RELEASE_ROUNDS * (NPROCS + 1), start, currentTime());
+}
+
+static void inversion(void)
+{
+    int i, start, status;
+    MboxStatsInfo stats;
+
+    mbox_a = MboxCreate(0, MAX_MESSAGE);
+    hog_sem = SemCreate(0);
+
+    start = currentTime();
+    fork1("InvReceiver", InvReceiver, NULL, 2 * USLOSS_MIN_STACK, 5);
+    fork1("InvHog", InvHog, NULL, 2 * USLOSS_MIN_STACK, 3);
+    fork1("InvSender", InvSender, NULL, 2 * USLOSS_MIN_STACK, 2);
+    for (i = 0; i < 3; i++)
+        join(&status);
+    benchReport("inversion", 2 * INVERSION_ROUNDS, start, currentTime());
+
+    MboxStats(mbox_a, &stats);
+    USLOSS_Console("%-24s %8d waits %10ld us %8.1f us/wait\n", "  inverted",
+                   stats.inversions, stats.inversionTime,
+                   stats.inversions > 0 ? (double)stats.inversionTime / stats.inversions : 0.0);
+
+    MboxRelease(mbox_a);
+    SemFree(hog_sem);
+}
+
+static void pipeline(char *name, int forward)
+{
+    int i, start, status;
+    char bulk[MAX_MESSAGE] = "benchmark message";
+
+    for (i = 0; i < PIPE_BOXES; i++)
+        pipe_boxes[i] = MboxCreate(10, MAX_MESSAGE);
+    pipe_forward = forward;
+
+    start = currentTime();
+    for (i = 0; i < PIPE_BOXES - 1; i++)
+        fork1("PipeStage", PipeStage, pipe_args[i], 2 * USLOSS_MIN_STACK, 2);
+    fork1("PipeSink", PipeSink, NULL, 2 * USLOSS_MIN_STACK, 2);
+    for (i = 0; i < ITERATIONS; i++)
+        MboxSend(pipe_boxes[0], bulk, sizeof(bulk));
+    for (i = 0; i < PIPE_BOXES; i++)
+        join(&status);
+    benchReport(name, PIPE_BOXES * ITERATIONS, start, currentTime());
+
+    for (i = 0; i < PIPE_BOXES; i++)
+        MboxRelease(pipe_boxes[i]);
+}
+
+static void recvLoan(char *name, int loaned)
+{
+    int i, j, start;
+    char bulk[MAX_MESSAGE] = "benchmark message";
+    char buf[MAX_MESSAGE];
+    void *loan;
+
+    mbox_a = MboxCreate(50, MAX_MESSAGE);
+
+    start = currentTime();
+    for (i = 0; i < ITERATIONS / 50; i++) {
+        for (j = 0; j < 50; j++)
+            MboxSend(mbox_a, bulk, sizeof(bulk));
+        for (j = 0; j < 50; j++) {
+            if (loaned) {
+                MboxRecvLoan(mbox_a, &loan);
+                MboxReturnLoan(loan);
+            } else {
+                MboxRecv(mbox_a, buf, sizeof(buf));
+            }
+        }
+    }
+    benchReport(name, 2 * ITERATIONS, start, currentTime());
+
+    MboxRelease(mbox_a);
+}
+
+static void sendRef(void)
+{
+    int i, j, start;
+    void *buf;
+
+    mbox_a = MboxCreate(50, sizeof(MboxRef));
+
+    start = currentTime();
+    for (i = 0; i < ITERATIONS / 50; i++) {
+        for (j = 0; j < 50; j++)
+            MboxSendRef(mbox_a, ref_buf, sizeof(ref_buf));
+        for (j = 0; j < 50; j++)
+            MboxRecvRef(mbox_a, &buf);
+    }
+    benchReport("send-ref", 2 * ITERATIONS, start, currentTime());
+
+    MboxRelease(mbox_a);
+}
+
+
+
+int start2(char *arg)
+{
+    USLOSS_Console("start2(): mailbox benchmarks, %d iterations, %d processes\n",
+                   ITERATIONS, NPROCS);
+
+    pingpong();
+    fanIn();
+    fanOut();
+    fullBox();
+    condSend();
+    release();
+    inversion();
+    pipeline("pipe-copy", 0);
+    pipeline("pipe-forward", 1);
+    recvLoan("recv-copy", 0);
+    recvLoan("recv-loan", 1);
+    sendRef();
+
+    quit(0);
+}
+
+int Echo(char *arg)
+{
+    int i;
+    char buf[MAX_MESSAGE];
+
+    for (i = 0; i < ITERATIONS; i++) {
+        MboxRecv(mbox_a, buf, sizeof(buf));
+        MboxSend(mbox_b, buf, sizeof(msg));
+    }
+
+    quit(1);
+}
+
+int Producer(char *arg)
+{
+    int i;
+
+    for (i = 0; i < ITERATIONS / NPROCS; i++)
+        MboxSend(mbox_a, msg, sizeof(msg));
+
+    quit(2);
+}
+
+int Consumer(char *arg)
+{
+    int i;
+    char buf[MAX_MESSAGE];
+
+    for (i = 0; i < ITERATIONS / NPROCS; i++)
+        MboxRecv(mbox_a, buf, sizeof(buf));
+
+    quit(3);
+}
+
+int FullSender(char *arg)
+{
+    int i;
+
+    for (i = 0; i < ITERATIONS / 3; i++)
+        MboxSend(mbox_a, msg, sizeof(msg));
+
+    quit(4);
+}
+
+int FullReceiver(char *arg)
+{
+    int i;
+    char buf[MAX_MESSAGE];
+
+    for (i = 0; i < 3 * (ITERATIONS / 3); i++)
+        MboxRecv(mbox_a, buf, sizeof(buf));
+
+    quit(5);
+}
+
+int ReleaseDriver(char *arg)
+{
+    int i, round, status;
+
+    for (round = 0; round < RELEASE_ROUNDS; round++) {
+        mbox_a = MboxCreate(1, MAX_MESSAGE);
+        for (i = 0; i < NPROCS; i++)
+            fork1("ReleaseWaiter", ReleaseWaiter, NULL, 2 * USLOSS_MIN_STACK, 4);
+        MboxRelease(mbox_a);
+        for (i = 0; i < NPROCS; i++)
+            join(&status);
+    }
+
+    quit(6);
+}
+
+int ReleaseWaiter(char *arg)
+{
+    char buf[MAX_MESSAGE];
+
+    MboxRecv(mbox_a, buf, sizeof(buf));
+
+    quit(7);
+}
+
+int InvSender(char *arg)
+{
+    int i;
+
+    MboxSetPriority(2);
+    for (i = 0; i < INVERSION_ROUNDS; i++) {
+        SemV(hog_sem);
+        MboxSend(mbox_a, msg, sizeof(msg));
+    }
+
+    quit(8);
+}
+
+int InvReceiver(char *arg)
+{
+    int i;
+    char buf[MAX_MESSAGE];
+
+    MboxSetPriority(5);
+    for (i = 0; i < INVERSION_ROUNDS; i++)
+        MboxRecv(mbox_a, buf, sizeof(buf));
+
+    quit(9);
+}
+
+int InvHog(char *arg)
+{
+    int i;
+    volatile int spin;
+
+    MboxSetPriority(3);
+    for (i = 0; i < INVERSION_ROUNDS; i++) {
+        SemP(hog_sem);
+        for (spin = 0; spin < HOG_SPIN; spin++)
+            ;
+    }
+
+    quit(10);
+}
+
+int PipeStage(char *arg)
+{
+    int i, size;
+    int stage = arg[0] - '0';
+    char buf[MAX_MESSAGE];
+
+    for (i = 0; i < ITERATIONS; i++) {
+        if (pipe_forward) {
+            MboxForward(pipe_boxes[stage], pipe_boxes[stage + 1]);
+        } else {
+            size = MboxRecv(pipe_boxes[stage], buf, sizeof(buf));
+            MboxSend(pipe_boxes[stage + 1], buf, size);
+        }
+    }
+
+    quit(11);
+}
+
+int PipeSink(char *arg)
+{
+    int i;
+    char buf[MAX_MESSAGE];
+
+    for (i = 0; i < ITERATIONS; i++)
+        MboxRecv(pipe_boxes[PIPE_BOXES - 1], buf, sizeof(buf));
+
+    quit(12);
+}
@@ -0,0 +1,108 @@
+
+/* Compares P/V latency of the native semaphores with a semaphore emulated
+ * by a zero-length message on a one-slot mailbox.
+ *
+ * Two shapes are measured for each implementation:
+ *   - uncontended: start2 does V then P on its own semaphore, never blocks.
+ *   - ping-pong:   start2 and a child of the same priority hand control back
+ *                  and forth through two semaphores, blocking every time.
+ * Times are simulated microseconds from currentTime().
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+#include "bench.h"
+
+#define ITERATIONS 10000
+
+int XXpSem(char *);
+int XXpMbox(char *);
+
+int ping, pong;
+
+
+
+
+int start2(char *arg)
+{
+    int i, start, status;
+
+    USLOSS_Console("start2(): semaphore benchmark, %d iterations\n", ITERATIONS);
+
+    /* uncontended, native */
+    ping = SemCreate(0);
+    start = currentTime();
+    for (i = 0; i < ITERATIONS; i++) {
+        SemV(ping);
+        SemP(ping);
+    }
+    benchReport("sem uncontended", 2 * ITERATIONS, start, currentTime());
+    SemFree(ping);
+
+    /* uncontended, mailbox-emulated */
+    ping = MboxCreate(1, 0);
+    start = currentTime();
+    for (i = 0; i < ITERATIONS; i++) {
+        MboxSend(ping, NULL, 0);
+        MboxRecv(ping, NULL, 0);
+    }
+    benchReport("mbox uncontended", 2 * ITERATIONS, start, currentTime());
+    MboxRelease(ping);
+
+    /* ping-pong, native */
+    ping = SemCreate(0);
+    pong = SemCreate(0);
+    fork1("XXpSem", XXpSem, NULL, 2 * USLOSS_MIN_STACK, 1);
+    start = currentTime();
+    for (i = 0; i < ITERATIONS; i++) {
+        SemV(ping);
+        SemP(pong);
+    }
+    benchReport("sem ping-pong", 2 * ITERATIONS, start, currentTime());
+    join(&status);
+    SemFree(ping);
+    SemFree(pong);
+
+    /* ping-pong, mailbox-emulated */
+    ping = MboxCreate(1, 0);
+    pong = MboxCreate(1, 0);
+    fork1("XXpMbox", XXpMbox, NULL, 2 * USLOSS_MIN_STACK, 1);
+    start = currentTime();
+    for (i = 0; i < ITERATIONS; i++) {
+        MboxSend(ping, NULL, 0);
+        MboxRecv(pong, NULL, 0);
+    }
+    benchReport("mbox ping-pong", 2 * ITERATIONS, start, currentTime());
+    join(&status);
+    MboxRelease(ping);
+    MboxRelease(pong);
+
+    quit(0);
+}
+
+int XXpSem(char *arg)
+{
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        SemP(ping);
+        SemV(pong);
+    }
+
+    quit(1);
+}
+
+int XXpMbox(char *arg)
+{
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        MboxRecv(ping, NULL, 0);
+        MboxSend(pong, NULL, 0);
+    }
+
+    quit(1);
+}
@@ -0,0 +1,127 @@
+
+/* Throughput of the multi-threaded mailbox backend with real host threads:
+ *
+ *   spsc       one producer thread, one consumer thread, 64-slot mailbox
+ *   mpmc       NTHREADS producers and NTHREADS consumers on one mailbox
+ *   pingpong   two threads bouncing a message through 1-slot mailboxes,
+ *              so every operation sleeps and wakes through the futex
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <phase2.h>
+
+#define ITERATIONS  1000000
+#define NTHREADS    4
+
+int mbox_a, mbox_b;
+char msg[] = "benchmark message";
+
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void report(char *name, long ops, double start, double end)
+{
+    double elapsed = end - start;
+
+    printf("%-24s %8ld ops %10.0f us %12.0f ops/s %8.3f us/op\n",
+           name, ops, elapsed, ops * 1e6 / elapsed, elapsed / ops);
+}
+
+static void *producer(void *arg)
+{
+    long count = (long)arg;
+
+    for (long i = 0; i < count; i++)
+        MboxSend(mbox_a, msg, sizeof(msg));
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    long count = (long)arg;
+    char buf[MAX_MESSAGE];
+
+    for (long i = 0; i < count; i++)
+        MboxRecv(mbox_a, buf, sizeof(buf));
+    return NULL;
+}
+
+static void *echo(void *arg)
+{
+    char buf[MAX_MESSAGE];
+
+    for (int i = 0; i < ITERATIONS / 10; i++) {
+        MboxRecv(mbox_a, buf, sizeof(buf));
+        MboxSend(mbox_b, buf, sizeof(msg));
+    }
+    return NULL;
+}
+
+static void fanThreads(char *name, int producers, int consumers)
+{
+    pthread_t threads[2 * NTHREADS];
+    double start;
+    int n = 0;
+
+    mbox_a = MboxCreate(64, MAX_MESSAGE);
+
+    start = now();
+    for (int i = 0; i < producers; i++)
+        pthread_create(&threads[n++], NULL, producer,
+                       (void *)(long)(ITERATIONS / producers));
+    for (int i = 0; i < consumers; i++)
+        pthread_create(&threads[n++], NULL, consumer,
+                       (void *)(long)(ITERATIONS / consumers));
+    for (int i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+    report(name, 2L * ITERATIONS, start, now());
+
+    MboxRelease(mbox_a);
+}
+
+static void pingpong(void)
+{
+    pthread_t thread;
+    char buf[MAX_MESSAGE];
+    double start;
+
+    mbox_a = MboxCreate(1, MAX_MESSAGE);
+    mbox_b = MboxCreate(1, MAX_MESSAGE);
+    pthread_create(&thread, NULL, echo, NULL);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS / 10; i++) {
+        MboxSend(mbox_a, msg, sizeof(msg));
+        MboxRecv(mbox_b, buf, sizeof(buf));
+    }
+    pthread_join(thread, NULL);
+    report("pingpong", 4L * (ITERATIONS / 10), start, now());
+
+    MboxRelease(mbox_a);
+    MboxRelease(mbox_b);
+}
+
+
+
+int main(int argc, char **argv)
+{
+    phase2_init();
+
+    printf("main(): threaded mailbox benchmarks, %d iterations, %d threads\n",
+           ITERATIONS, NTHREADS);
+
+    fanThreads("spsc", 1, 1);
+    fanThreads("mpmc", NTHREADS, NTHREADS);
+    pingpong();
+
+    return 0;
+}
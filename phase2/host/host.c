@@ -0,0 +1,524 @@
+
+/*
+ * Host-native stand-in for USLOSS and phase 1.
+ *
+ * Links the unmodified phase 2 engine (and any testcase or benchmark) into
+ * an ordinary Linux process, so that it can run at native speed and be
+ * profiled with perf.  Processes are ucontext coroutines on one host thread,
+ * scheduled by strict priority like phase 1: a process runs until it
+ * blocks, quits, or forks/unblocks a higher-priority process.  Because there
+ * is only one host thread, the PSR is just a variable and nothing is ever
+ * interrupted asynchronously.
+ *
+ * currentTime() is the host's monotonic clock in microseconds.  Only the
+ * clock device is modelled: when every process is blocked and some are in
+ * waitDevice(), the sentinel sleeps to the next clock tick and delivers it.
+ * Disk and terminal units accept requests but never complete them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+#define CLOCK_TICK          20000       // us between clock interrupts
+
+#define PROC_FREE           0
+#define PROC_READY          1
+#define PROC_RUNNING        2
+#define PROC_JOIN_BLOCKED   3
+#define PROC_ZAP_BLOCKED    4
+#define PROC_QUIT           5
+// anything above 10 is a blockMe() status
+
+typedef struct HostProc HostProc;
+
+struct HostProc {
+    int        pid;
+    char       name[MAXNAME];
+    int        priority;
+    int        basePriority;    // priority from fork1(), without inheritance
+    int        state;
+    int        status;
+    int        parentPid;
+    int        numChildren;
+    int        zapTarget;
+    int        zapped;
+    int        startTime;
+    int        cpuTime;
+    int      (*func)(char *);
+    char      *arg;
+    char      *stack;
+    ucontext_t context;
+    HostProc  *nextReady;
+};
+
+// provided by the testcase code
+extern void startup(int argc, char **argv);
+extern void finish(int argc, char **argv);
+extern void mmu_init_proc(int pid);
+extern void mmu_quit(int pid);
+extern void mmu_flush(void);
+extern int  testcase_main(void);
+extern void phase3_start_service_processes(void);
+extern void phase4_start_service_processes(void);
+extern void phase5_start_service_processes(void);
+
+void (*USLOSS_IntVec[USLOSS_NUM_INTS])(int dev, void *arg);
+
+static HostProc   procTable[MAXPROC];
+static HostProc  *readyHead[MAXPRIORITY + 1];
+static HostProc  *readyTail[MAXPRIORITY + 1];
+static HostProc  *current;
+static int        nextPid = 1;
+static unsigned   psr = USLOSS_PSR_CURRENT_MODE;
+static long long  bootTime;
+static int        hostArgc;
+static char     **hostArgv;
+static ucontext_t mainContext;
+
+static void dispatch(void);
+
+
+
+// ----- USLOSS
+
+void USLOSS_Console(char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    fflush(stdout);
+}
+
+void USLOSS_Halt(int status) {
+    finish(hostArgc, hostArgv);
+    exit(status);
+}
+
+unsigned int USLOSS_PsrGet(void) {
+    return psr;
+}
+
+int USLOSS_PsrSet(unsigned int value) {
+    psr = value & 0xf;
+    return USLOSS_DEV_OK;
+}
+
+int USLOSS_DeviceInput(int dev, int unit, int *status) {
+    *status = dev == USLOSS_CLOCK_DEV ? currentTime() : USLOSS_DEV_OK;
+    return USLOSS_DEV_OK;
+}
+
+int USLOSS_DeviceOutput(int dev, int unit, void *arg) {
+    return USLOSS_DEV_OK;
+}
+
+/**
+ * Traps into the syscall vector in kernel mode, restoring the caller's
+ * mode afterwards, as the USLOSS syscall instruction does.
+ */
+void USLOSS_Syscall(void *arg) {
+    unsigned saved = psr;
+    psr = ((psr & 0x3) << 2) | USLOSS_PSR_CURRENT_MODE;
+    USLOSS_IntVec[USLOSS_SYSCALL_INT](USLOSS_SYSCALL_INT, arg);
+    psr = saved;
+}
+
+void USLOSS_WaitInt(void) {
+    int wait = CLOCK_TICK - currentTime() % CLOCK_TICK;
+    usleep(wait);
+}
+
+
+
+// ----- Scheduling
+
+static HostProc *findProc(int pid) {
+    HostProc *proc = &procTable[pid % MAXPROC];
+    return proc->state != PROC_FREE && proc->pid == pid ? proc : NULL;
+}
+
+static void makeReady(HostProc *proc) {
+    proc->state = PROC_READY;
+    proc->nextReady = NULL;
+    if (readyTail[proc->priority] == NULL) {
+        readyHead[proc->priority] = proc;
+    } else {
+        readyTail[proc->priority]->nextReady = proc;
+    }
+    readyTail[proc->priority] = proc;
+}
+
+/**
+ * Switches to the highest-priority ready process, unless the current
+ * process is still runnable and at least as important.  A running process
+ * that loses the CPU goes to the back of its ready queue.
+ */
+static void dispatch(void) {
+    HostProc *next = NULL;
+    int prio;
+
+    for (prio = 1; prio <= MAXPRIORITY; prio++) {
+        if (readyHead[prio] != NULL) {
+            next = readyHead[prio];
+            break;
+        }
+    }
+
+    if (next == NULL) {
+        if (current != NULL && current->state == PROC_RUNNING) {
+            return;
+        }
+        USLOSS_Console("dispatch(): no runnable process, not even the sentinel\n");
+        USLOSS_Halt(1);
+    }
+    if (current != NULL && current->state == PROC_RUNNING &&
+        current->priority <= prio) {
+        return;
+    }
+
+    readyHead[prio] = next->nextReady;
+    if (readyHead[prio] == NULL) {
+        readyTail[prio] = NULL;
+    }
+
+    HostProc *old = current;
+    int now = currentTime();
+    if (old != NULL) {
+        old->cpuTime += now - old->startTime;
+        if (old->state == PROC_RUNNING) {
+            makeReady(old);
+        }
+    }
+
+    next->state = PROC_RUNNING;
+    next->startTime = now;
+    current = next;
+
+    mmu_flush();
+    if (old == NULL) {
+        swapcontext(&mainContext, &next->context);
+    } else {
+        swapcontext(&old->context, &next->context);
+    }
+}
+
+static void launch(void) {
+    psr = USLOSS_PSR_CURRENT_MODE | USLOSS_PSR_CURRENT_INT;
+    quit(current->func(current->arg));
+}
+
+/**
+ * Creates a process without the argument checks that fork1() applies to
+ * callers, so that init and the sentinel can use priorities 6 and 7.
+ */
+static int spawn(char *name, int (*func)(char *), char *arg, int stacksize,
+                 int priority) {
+    HostProc *proc = NULL;
+
+    for (int i = 0; i < MAXPROC; i++, nextPid++) {
+        if (procTable[nextPid % MAXPROC].state == PROC_FREE) {
+            proc = &procTable[nextPid % MAXPROC];
+            break;
+        }
+    }
+    if (proc == NULL) {
+        return -1;
+    }
+
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = nextPid++;
+    strncpy(proc->name, name, MAXNAME - 1);
+    proc->priority = priority;
+    proc->basePriority = priority;
+    proc->parentPid = current != NULL ? current->pid : 0;
+    proc->func = func;
+    proc->arg = arg;
+    proc->stack = malloc(stacksize);
+
+    getcontext(&proc->context);
+    proc->context.uc_stack.ss_sp = proc->stack;
+    proc->context.uc_stack.ss_size = stacksize;
+    proc->context.uc_link = NULL;
+    makecontext(&proc->context, launch, 0);
+
+    if (current != NULL) {
+        current->numChildren++;
+        mmu_init_proc(proc->pid);
+    }
+    makeReady(proc);
+    return proc->pid;
+}
+
+
+
+// ----- Phase 1
+
+static int sentinel(char *arg) {
+    while (1) {
+        if (!phase2_check_io()) {
+            USLOSS_Console("sentinel(): deadlock detected, halting\n");
+            USLOSS_Halt(1);
+        }
+        USLOSS_WaitInt();
+        phase2_clockHandler();
+    }
+}
+
+static int testcaseMain(char *arg) {
+    USLOSS_Halt(testcase_main());
+}
+
+static int init(char *arg) {
+    int status;
+
+    phase2_start_service_processes();
+    phase3_start_service_processes();
+    phase4_start_service_processes();
+    phase5_start_service_processes();
+
+    spawn("sentinel", sentinel, NULL, USLOSS_MIN_STACK, MAXPRIORITY);
+    spawn("testcase_main", testcaseMain, NULL, USLOSS_MIN_STACK, 3);
+    dispatch();
+
+    while (join(&status) != -2) {
+    }
+    USLOSS_Console("init(): all processes have quit, halting\n");
+    USLOSS_Halt(0);
+}
+
+void phase1_init(void) {
+    memset(procTable, 0, sizeof(procTable));
+}
+
+void startProcesses(void) {
+    spawn("init", init, NULL, USLOSS_MIN_STACK, MAXPRIORITY - 1);
+    dispatch();
+}
+
+/**
+ * Creates a child of the current process. Returns its pid, -1 for a bad
+ * name or priority or a full process table, or -2 if the stack is too small.
+ */
+int fork1(char *name, int (*func)(char *), char *arg, int stacksize,
+          int priority) {
+    if (name == NULL || strlen(name) >= MAXNAME || func == NULL ||
+        priority < 1 || priority > MAXPRIORITY - 2) {
+        return -1;
+    }
+    if (stacksize < USLOSS_MIN_STACK) {
+        return -2;
+    }
+
+    int pid = spawn(name, func, arg, stacksize, priority);
+    if (pid >= 0) {
+        dispatch();
+    }
+    return pid;
+}
+
+/**
+ * Waits for any child to quit and reaps it. Returns the child's pid, or -2
+ * if the caller has no children.
+ */
+int join(int *status) {
+    if (current->numChildren == 0) {
+        return -2;
+    }
+
+    while (1) {
+        for (int i = 0; i < MAXPROC; i++) {
+            HostProc *child = &procTable[i];
+            if (child->state == PROC_QUIT && child->parentPid == current->pid) {
+                int pid = child->pid;
+                *status = child->status;
+                free(child->stack);
+                child->state = PROC_FREE;
+                current->numChildren--;
+                return pid;
+            }
+        }
+        current->state = PROC_JOIN_BLOCKED;
+        dispatch();
+    }
+}
+
+void quit(int status) {
+    if (current->numChildren > 0) {
+        USLOSS_Console("ERROR: Process pid %d called quit() while it still had children.\n",
+                       current->pid);
+        USLOSS_Halt(1);
+    }
+
+    current->status = status;
+    current->state = PROC_QUIT;
+    mmu_quit(current->pid);
+
+    HostProc *parent = findProc(current->parentPid);
+    if (parent != NULL && parent->state == PROC_JOIN_BLOCKED) {
+        makeReady(parent);
+    }
+    for (int i = 0; i < MAXPROC; i++) {
+        if (procTable[i].state == PROC_ZAP_BLOCKED &&
+            procTable[i].zapTarget == current->pid) {
+            makeReady(&procTable[i]);
+        }
+    }
+
+    dispatch();
+    USLOSS_Console("quit(): dispatcher returned to a dead process\n");
+    USLOSS_Halt(1);
+}
+
+int getpid(void) {
+    return current->pid;
+}
+
+void dumpProcesses(void) {
+    USLOSS_Console(" PID  PPID  NAME              PRIORITY  STATE\n");
+    for (int i = 0; i < MAXPROC; i++) {
+        HostProc *proc = &procTable[i];
+        if (proc->state == PROC_FREE) {
+            continue;
+        }
+        USLOSS_Console("%4d  %4d  %-16s  %8d  ", proc->pid, proc->parentPid,
+                       proc->name, proc->priority);
+        switch (proc->state) {
+        case PROC_READY:        USLOSS_Console("Runnable\n");             break;
+        case PROC_RUNNING:      USLOSS_Console("Running\n");              break;
+        case PROC_JOIN_BLOCKED: USLOSS_Console("Blocked(waiting for child to quit)\n"); break;
+        case PROC_ZAP_BLOCKED:  USLOSS_Console("Blocked(waiting for zap target to quit)\n"); break;
+        case PROC_QUIT:         USLOSS_Console("Terminated(%d)\n", proc->status); break;
+        default:                USLOSS_Console("Blocked(%d)\n", proc->state); break;
+        }
+    }
+}
+
+/**
+ * Marks the process as zapped and blocks until it quits.
+ */
+void zap(int pid) {
+    HostProc *target = findProc(pid);
+
+    if (target == NULL || target == current) {
+        USLOSS_Console("ERROR: Attempt to zap() an invalid process.  pid: %d\n", pid);
+        USLOSS_Halt(1);
+    }
+
+    target->zapped = 1;
+    while (target->pid == pid && target->state != PROC_QUIT &&
+           target->state != PROC_FREE) {
+        current->zapTarget = pid;
+        current->state = PROC_ZAP_BLOCKED;
+        dispatch();
+    }
+}
+
+int isZapped(void) {
+    return current->zapped;
+}
+
+void blockMe(int block_status) {
+    if (block_status <= 10) {
+        USLOSS_Console("ERROR: blockMe() called with an invalid status %d\n", block_status);
+        USLOSS_Halt(1);
+    }
+    current->state = block_status;
+    dispatch();
+}
+
+/**
+ * Makes a process blocked in blockMe() runnable, switching to it at once if
+ * it outranks the caller. Returns 0, or -2 if it was not so blocked.
+ */
+int unblockProc(int pid) {
+    HostProc *proc = findProc(pid);
+
+    if (proc == NULL || proc->state <= 10) {
+        return -2;
+    }
+    makeReady(proc);
+    dispatch();
+    return 0;
+}
+
+/**
+ * Host-only extension used by phase 2's priority inheritance: runs pid at
+ * the given priority if that is better than its own, or back at its own
+ * priority when priority is 0. Never switches processes by itself.
+ */
+void inheritPriority(int pid, int priority) {
+    HostProc *proc = findProc(pid);
+
+    if (proc == NULL) {
+        return;
+    }
+    if (priority == 0 || priority > proc->basePriority) {
+        priority = proc->basePriority;
+    }
+    if (priority == proc->priority) {
+        return;
+    }
+
+    if (proc->state == PROC_READY) {
+        HostProc **link = &readyHead[proc->priority];
+        HostProc *prev = NULL;
+        while (*link != proc) {
+            prev = *link;
+            link = &(*link)->nextReady;
+        }
+        *link = proc->nextReady;
+        if (readyTail[proc->priority] == proc) {
+            readyTail[proc->priority] = prev;
+        }
+        proc->priority = priority;
+        makeReady(proc);
+    } else {
+        proc->priority = priority;
+    }
+}
+
+int readCurStartTime(void) {
+    return current->startTime;
+}
+
+void timeSlice(void) {
+    if (currentTime() - current->startTime >= 80000) {
+        makeReady(current);
+        dispatch();
+    }
+}
+
+int readtime(void) {
+    return (current->cpuTime + currentTime() - current->startTime) / 1000;
+}
+
+int currentTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int)(now.tv_sec * 1000000LL + now.tv_nsec / 1000 - bootTime);
+}
+
+
+
+int main(int argc, char **argv) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bootTime = now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+
+    hostArgc = argc;
+    hostArgv = argv;
+    startup(argc, argv);
+
+    // startProcesses() only comes back here if init could not be created
+    USLOSS_Console("main(): could not start init\n");
+    return 1;
+}
@@ -0,0 +1,372 @@
+
+/*
+ * Multi-threaded mailbox backend for host-side tools.
+ *
+ * Implements the core mailbox calls from phase2.h for callers that are real
+ * host threads rather than USLOSS processes.  Each mailbox is a bounded
+ * MPMC ring of sequence-numbered cells: a sender claims a cell by advancing
+ * the enqueue position with a CAS once the cell's sequence says it is empty,
+ * copies the message in, and publishes it by bumping the sequence; receivers
+ * do the mirror image.  Sequences count in steps of two, so that a filled
+ * cell can't be mistaken for the next lap's empty one even in a 1-slot box.
+ *
+ * No lock is taken on the send/receive path.  A thread sleeps on a futex
+ * only when its mailbox is full (senders) or empty (receivers), and the
+ * other side issues a wake only if someone is sleeping.
+ *
+ * Creation and release are rare, so they serialize on a mutex.  Zero-slot
+ * (rendezvous) mailboxes need a partner handshake rather than a ring and are
+ * not supported here; MboxCreate(0, ...) returns -1.
+ *
+ * Built into libphase2_mt.a; never linked together with phase2.c.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <phase2.h>
+
+#define CACHE_LINE  64
+
+#define BOX_FREE        0
+#define BOX_LIVE        1
+#define BOX_RELEASED    2
+
+typedef struct Cell {
+    atomic_size_t seq;      // 2 * pos while empty, 2 * pos + 1 once filled
+    int           size;
+    char          msg[];
+} Cell;
+
+typedef struct MtMailbox {
+    atomic_int    state;
+    atomic_int    users;    // threads inside a send or receive
+    int           numSlots;
+    int           slotSize;
+    size_t        cellSize;
+    char         *cells;
+
+    _Alignas(CACHE_LINE) atomic_size_t enqueuePos;
+    _Alignas(CACHE_LINE) atomic_size_t dequeuePos;
+
+    // futex words: bumped on every dequeue/enqueue that might unblock the
+    // other side, so a sleeper whose snapshot is stale never sleeps
+    _Alignas(CACHE_LINE) atomic_uint notFull;
+    atomic_int    sendWaiters;
+    _Alignas(CACHE_LINE) atomic_uint notEmpty;
+    atomic_int    recvWaiters;
+} MtMailbox;
+
+static MtMailbox       mailboxes[MAXMBOX];
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+// ----- Helpers
+
+static void futexWait(atomic_uint *word, unsigned seen) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static void futexWake(atomic_uint *word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static Cell *cellAt(MtMailbox *box, size_t pos) {
+    return (Cell *)(box->cells + (pos % box->numSlots) * box->cellSize);
+}
+
+/**
+ * Looks up a live mailbox and registers the caller as a user, so that
+ * MboxRelease() cannot free the cells underneath it. Returns NULL if the id
+ * is invalid or the mailbox is not live.
+ */
+static MtMailbox *enterMailbox(int mbox_id) {
+    if (mbox_id < 0 || mbox_id >= MAXMBOX) {
+        return NULL;
+    }
+    MtMailbox *box = &mailboxes[mbox_id];
+    atomic_fetch_add(&box->users, 1);
+    if (atomic_load(&box->state) != BOX_LIVE) {
+        atomic_fetch_sub(&box->users, 1);
+        return NULL;
+    }
+    return box;
+}
+
+static void leaveMailbox(MtMailbox *box) {
+    atomic_fetch_sub(&box->users, 1);
+}
+
+/**
+ * Claims the next cell for a sender. Returns 0, or -2 if the ring is full.
+ */
+static int tryEnqueue(MtMailbox *box, void *msg, int size) {
+    size_t pos = atomic_load_explicit(&box->enqueuePos, memory_order_relaxed);
+
+    while (1) {
+        Cell *cell = cellAt(box, pos);
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        long diff = (long)seq - (long)(2 * pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&box->enqueuePos, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->size = size;
+                memcpy(cell->msg, msg, size);
+                atomic_store_explicit(&cell->seq, 2 * pos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -2;
+        } else {
+            pos = atomic_load_explicit(&box->enqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Takes the oldest message. Returns its size, -1 if it does not fit in
+ * max_size (the message is still consumed), or -2 if the ring is empty.
+ */
+static int tryDequeue(MtMailbox *box, void *msg, int max_size) {
+    size_t pos = atomic_load_explicit(&box->dequeuePos, memory_order_relaxed);
+
+    while (1) {
+        Cell *cell = cellAt(box, pos);
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        long diff = (long)seq - (long)(2 * pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&box->dequeuePos, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                int size = cell->size;
+                if (size <= max_size) {
+                    memcpy(msg, cell->msg, size);
+                }
+                atomic_store_explicit(&cell->seq, 2 * (pos + box->numSlots),
+                                      memory_order_release);
+                return size <= max_size ? size : -1;
+            }
+        } else if (diff < 0) {
+            return -2;
+        } else {
+            pos = atomic_load_explicit(&box->dequeuePos, memory_order_relaxed);
+        }
+    }
+}
+
+// wakes one sleeper on the given side, if there is one
+static void wakeSide(atomic_uint *word, atomic_int *waiters) {
+    atomic_fetch_add(word, 1);
+    if (atomic_load(waiters) > 0) {
+        futexWake(word, 1);
+    }
+}
+
+
+
+// ----- Public API
+
+void phase2_init(void) {
+    memset(mailboxes, 0, sizeof(mailboxes));
+}
+
+/**
+ * Creates a mailbox with a ring of the given number of cells. Returns its
+ * id, or -1 if the arguments are invalid, slots is 0, or every id is taken.
+ */
+int MboxCreate(int slots, int slot_size) {
+    if (slots < 1 || slot_size < 0 || slot_size > MAX_MESSAGE) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&tableLock);
+    int id;
+    for (id = 0; id < MAXMBOX; id++) {
+        if (atomic_load(&mailboxes[id].state) == BOX_FREE) {
+            break;
+        }
+    }
+    if (id == MAXMBOX) {
+        pthread_mutex_unlock(&tableLock);
+        return -1;
+    }
+
+    MtMailbox *box = &mailboxes[id];
+    box->numSlots = slots;
+    box->slotSize = slot_size;
+    box->cellSize = (sizeof(Cell) + slot_size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    box->cells = aligned_alloc(CACHE_LINE, box->cellSize * slots);
+    for (int i = 0; i < slots; i++) {
+        atomic_init(&cellAt(box, i)->seq, 2 * i);
+    }
+    atomic_init(&box->enqueuePos, 0);
+    atomic_init(&box->dequeuePos, 0);
+    atomic_init(&box->notFull, 0);
+    atomic_init(&box->notEmpty, 0);
+    atomic_init(&box->sendWaiters, 0);
+    atomic_init(&box->recvWaiters, 0);
+    atomic_store(&box->state, BOX_LIVE);
+    pthread_mutex_unlock(&tableLock);
+
+    return id;
+}
+
+/**
+ * Releases a mailbox. Every blocked sender and receiver returns -3; the
+ * cells are freed once the last of them has left. Returns 0, or -1 if the
+ * id is not a live mailbox.
+ */
+int MboxRelease(int mbox_id) {
+    if (mbox_id < 0 || mbox_id >= MAXMBOX) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&tableLock);
+    MtMailbox *box = &mailboxes[mbox_id];
+    int live = BOX_LIVE;
+    if (!atomic_compare_exchange_strong(&box->state, &live, BOX_RELEASED)) {
+        pthread_mutex_unlock(&tableLock);
+        return -1;
+    }
+
+    atomic_fetch_add(&box->notFull, 1);
+    atomic_fetch_add(&box->notEmpty, 1);
+    futexWake(&box->notFull, INT_MAX);
+    futexWake(&box->notEmpty, INT_MAX);
+    while (atomic_load(&box->users) > 0) {
+        sched_yield();
+    }
+
+    free(box->cells);
+    box->cells = NULL;
+    atomic_store(&box->state, BOX_FREE);
+    pthread_mutex_unlock(&tableLock);
+
+    return 0;
+}
+
+/**
+ * Sends a message, sleeping while the mailbox is full. Returns 0, -1 for
+ * invalid arguments, or -3 if the mailbox was released.
+ */
+int MboxSend(int mbox_id, void *msg_ptr, int msg_size) {
+    MtMailbox *box = enterMailbox(mbox_id);
+    if (box == NULL) {
+        return -1;
+    }
+    if (msg_size < 0 || msg_size > box->slotSize ||
+        (msg_ptr == NULL && msg_size > 0)) {
+        leaveMailbox(box);
+        return -1;
+    }
+
+    int result;
+    while ((result = tryEnqueue(box, msg_ptr, msg_size)) == -2) {
+        unsigned seen = atomic_load(&box->notFull);
+        atomic_fetch_add(&box->sendWaiters, 1);
+        if (atomic_load(&box->state) != BOX_LIVE) {
+            atomic_fetch_sub(&box->sendWaiters, 1);
+            leaveMailbox(box);
+            return -3;
+        }
+        if ((result = tryEnqueue(box, msg_ptr, msg_size)) == 0) {
+            atomic_fetch_sub(&box->sendWaiters, 1);
+            break;
+        }
+        futexWait(&box->notFull, seen);
+        atomic_fetch_sub(&box->sendWaiters, 1);
+    }
+
+    wakeSide(&box->notEmpty, &box->recvWaiters);
+    leaveMailbox(box);
+    return 0;
+}
+
+/**
+ * Receives a message, sleeping while the mailbox is empty. Returns the
+ * message size, -1 for invalid arguments or a message larger than
+ * msg_max_size, or -3 if the mailbox was released.
+ */
+int MboxRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
+    MtMailbox *box = enterMailbox(mbox_id);
+    if (box == NULL || msg_max_size < 0) {
+        if (box != NULL) {
+            leaveMailbox(box);
+        }
+        return -1;
+    }
+
+    int result;
+    while ((result = tryDequeue(box, msg_ptr, msg_max_size)) == -2) {
+        unsigned seen = atomic_load(&box->notEmpty);
+        atomic_fetch_add(&box->recvWaiters, 1);
+        if (atomic_load(&box->state) != BOX_LIVE) {
+            atomic_fetch_sub(&box->recvWaiters, 1);
+            leaveMailbox(box);
+            return -3;
+        }
+        if ((result = tryDequeue(box, msg_ptr, msg_max_size)) != -2) {
+            atomic_fetch_sub(&box->recvWaiters, 1);
+            break;
+        }
+        futexWait(&box->notEmpty, seen);
+        atomic_fetch_sub(&box->recvWaiters, 1);
+    }
+
+    wakeSide(&box->notFull, &box->sendWaiters);
+    leaveMailbox(box);
+    return result;
+}
+
+/**
+ * Sends without sleeping. Returns 0, -1 for invalid arguments, or -2 if
+ * the mailbox is full.
+ */
+int MboxCondSend(int mbox_id, void *msg_ptr, int msg_size) {
+    MtMailbox *box = enterMailbox(mbox_id);
+    if (box == NULL) {
+        return -1;
+    }
+    if (msg_size < 0 || msg_size > box->slotSize ||
+        (msg_ptr == NULL && msg_size > 0)) {
+        leaveMailbox(box);
+        return -1;
+    }
+
+    int result = tryEnqueue(box, msg_ptr, msg_size);
+    if (result == 0) {
+        wakeSide(&box->notEmpty, &box->recvWaiters);
+    }
+    leaveMailbox(box);
+    return result;
+}
+
+/**
+ * Receives without sleeping. Returns the message size, -1 for invalid
+ * arguments or a message that does not fit, or -2 if the mailbox is empty.
+ */
+int MboxCondRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
+    MtMailbox *box = enterMailbox(mbox_id);
+    if (box == NULL || msg_max_size < 0) {
+        if (box != NULL) {
+            leaveMailbox(box);
+        }
+        return -1;
+    }
+
+    int result = tryDequeue(box, msg_ptr, msg_max_size);
+    if (result != -2) {
+        wakeSide(&box->notFull, &box->sendWaiters);
+    }
+    leaveMailbox(box);
+    return result;
+}
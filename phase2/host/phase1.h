@@ -0,0 +1,41 @@
+/*
+ * Host build only: the phase 1 process interface, implemented by host.c.
+ */
+
+#ifndef _PHASE1_H
+#define _PHASE1_H
+
+#define MAXPROC      50
+#define MAXNAME      50
+#define MAXPRIORITY  7
+
+extern void phase1_init(void);
+extern void startProcesses(void);
+
+extern int  fork1(char *name, int (*func)(char *), char *arg,
+                  int stacksize, int priority);
+extern int  join(int *status);
+extern void quit(int status) __attribute__((__noreturn__));
+extern int  getpid(void);
+extern void dumpProcesses(void);
+
+extern void zap(int pid);
+extern int  isZapped(void);
+
+extern void blockMe(int block_status);
+extern int  unblockProc(int pid);
+
+extern int  readCurStartTime(void);
+extern void timeSlice(void);
+extern int  readtime(void);
+extern int  currentTime(void);
+
+// host-only: priority inheritance hook that phase 2 calls when present
+extern void inheritPriority(int pid, int priority);
+
+// phase 2 hooks that phase 1 calls
+extern void phase2_start_service_processes(void);
+extern int  phase2_check_io(void);
+extern void phase2_clockHandler(void);
+
+#endif
@@ -0,0 +1,299 @@
+
+/* Replays a recording made with RecordStart() (build a testcase with
+ * -DPHASE2_RECORD) against the mailbox engine, natively on the host shim.
+ *
+ * Every recorded pid becomes one worker process that issues that pid's
+ * calls in their recorded order.  Workers take turns so that calls also
+ * start in the recorded global order; a call that blocks passes the turn
+ * on, just as the original process did.  Mailbox ids are remapped through
+ * the recorded creates, and calls on mailboxes the recording never created
+ * (the device mailboxes, deliberately bad ids) are skipped.
+ *
+ * When nothing is runnable, the driver reports the elapsed time, then
+ * releases any mailbox still in use so that workers left blocked at the
+ * end of the recording can quit.
+ *
+ * Workers are all forked up front at one priority, so a recording may use
+ * at most MAXWORKERS distinct pids, and the original priorities are not
+ * reproduced.  The file name comes from $PHASE2_REPLAY, default
+ * phase2_record.txt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+#define MAXWORKERS      (MAXPROC - 8)
+#define REPLAY_BLOCKED  20
+
+typedef struct ReplayOp {
+    int time;
+    int pid;
+    int op;
+    int mbox;
+    int size;
+    int arg;        // slot count (creates), tag (sendtag, recvtag) or lane
+                    // (sendprio)
+    int arg2;       // lane count (createprio)
+    int worker;
+    int next;       // index of the same worker's next op, or -1
+} ReplayOp;
+
+static const char *opNames[] = {
+    [RECORD_CREATE]      = "create",
+    [RECORD_RELEASE]     = "release",
+    [RECORD_SEND]        = "send",
+    [RECORD_RECV]        = "recv",
+    [RECORD_CONDSEND]    = "condsend",
+    [RECORD_CONDRECV]    = "condrecv",
+    [RECORD_BROADCAST]   = "broadcast",
+    [RECORD_SUBSCRIBE]   = "subscribe",
+    [RECORD_UNSUBSCRIBE] = "unsubscribe",
+    [RECORD_SENDTAG]     = "sendtag",
+    [RECORD_RECVTAG]     = "recvtag",
+    [RECORD_CREATEPRIO]  = "createprio",
+    [RECORD_SENDPRIO]    = "sendprio",
+};
+
+static ReplayOp *ops;
+static int       numOps;
+static int       numWorkers;
+static int       workerFirst[MAXWORKERS];
+static int       workerPid[MAXWORKERS];
+static int       waitingFor[MAXWORKERS];
+static char      workerArg[MAXWORKERS][8];
+static int       turn;
+static int       skipped;
+static int       boxMap[MAXMBOX];
+static char     *buffer;
+
+int Driver(char *);
+int Worker(char *);
+
+
+
+static int parseOp(char *name) {
+    for (int op = 0; op < (int)(sizeof(opNames) / sizeof(opNames[0])); op++) {
+        if (strcmp(name, opNames[op]) == 0) {
+            return op;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Reads the recording and assigns each op to a worker. Returns 0, or -1
+ * if the file can't be read or has too many distinct pids.
+ */
+static int loadRecording(char *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        USLOSS_Console("replay: cannot open %s\n", path);
+        return -1;
+    }
+
+    int recordedPid[MAXWORKERS];
+    int workerLast[MAXWORKERS];
+    int capacity = 1024, maxSize = MAX_MESSAGE;
+    char line[128], name[16];
+
+    ops = malloc(capacity * sizeof(ReplayOp));
+    while (fgets(line, sizeof(line), in) != NULL) {
+        ReplayOp op;
+        op.arg = 0;
+        op.arg2 = 0;
+        if (sscanf(line, "%d %d %15s %d %d %d %d", &op.time, &op.pid, name,
+                   &op.mbox, &op.size, &op.arg, &op.arg2) < 5 ||
+            (op.op = parseOp(name)) < 0) {
+            continue;
+        }
+
+        int w;
+        for (w = 0; w < numWorkers && recordedPid[w] != op.pid; w++) {
+        }
+        if (w == numWorkers) {
+            if (numWorkers == MAXWORKERS) {
+                USLOSS_Console("replay: more than %d processes in %s\n", MAXWORKERS, path);
+                fclose(in);
+                return -1;
+            }
+            recordedPid[w] = op.pid;
+            workerFirst[w] = numOps;
+            numWorkers++;
+        } else {
+            ops[workerLast[w]].next = numOps;
+        }
+        workerLast[w] = numOps;
+        op.worker = w;
+        op.next = -1;
+
+        if (op.size > maxSize) {
+            maxSize = op.size;
+        }
+        if (numOps == capacity) {
+            capacity *= 2;
+            ops = realloc(ops, capacity * sizeof(ReplayOp));
+        }
+        ops[numOps++] = op;
+    }
+    fclose(in);
+
+    buffer = calloc(1, maxSize);
+    return 0;
+}
+
+// returns the replay id for a recorded mailbox id, or -1 if not created
+static int mapBox(int mbox) {
+    return mbox >= 0 && mbox < MAXMBOX ? boxMap[mbox] : -1;
+}
+
+static void issue(ReplayOp *op) {
+    int id;
+
+    if (op->op == RECORD_CREATE || op->op == RECORD_CREATEPRIO || op->op == RECORD_BROADCAST) {
+        if (op->op == RECORD_CREATE) {
+            id = MboxCreate(op->arg, op->size);
+        } else if (op->op == RECORD_CREATEPRIO) {
+            id = MboxCreatePrio(op->arg, op->size, op->arg2);
+        } else {
+            id = MboxCreateBroadcast(op->arg, op->size);
+        }
+        if (op->mbox >= 0 && op->mbox < MAXMBOX) {
+            boxMap[op->mbox] = id;
+        }
+        return;
+    }
+
+    id = mapBox(op->mbox);
+    if (id < 0) {
+        skipped++;
+        return;
+    }
+
+    switch (op->op) {
+    case RECORD_RELEASE:
+        MboxRelease(id);
+        boxMap[op->mbox] = -1;
+        break;
+    case RECORD_SEND:
+        MboxSend(id, buffer, op->size);
+        break;
+    case RECORD_RECV:
+        MboxRecv(id, buffer, op->size);
+        break;
+    case RECORD_CONDSEND:
+        MboxCondSend(id, buffer, op->size);
+        break;
+    case RECORD_CONDRECV:
+        MboxCondRecv(id, buffer, op->size);
+        break;
+    case RECORD_SUBSCRIBE:
+        MboxSubscribe(id);
+        break;
+    case RECORD_UNSUBSCRIBE:
+        MboxUnsubscribe(id);
+        break;
+    case RECORD_SENDTAG:
+        MboxSendTag(id, buffer, op->size, op->arg);
+        break;
+    case RECORD_RECVTAG:
+        MboxRecvTag(id, op->arg, buffer, op->size);
+        break;
+    case RECORD_SENDPRIO:
+        MboxSendPrio(id, buffer, op->size, op->arg);
+        break;
+    }
+}
+
+
+
+int start2(char *arg)
+{
+    int status;
+    char *path = getenv("PHASE2_REPLAY");
+
+    if (path == NULL)
+        path = "phase2_record.txt";
+    if (loadRecording(path) < 0)
+        quit(1);
+
+    for (int i = 0; i < MAXMBOX; i++)
+        boxMap[i] = -1;
+
+    fork1("Driver", Driver, NULL, USLOSS_MIN_STACK, 5);
+    join(&status);
+
+    quit(status);
+}
+
+int Driver(char *arg)
+{
+    int start, end, status, stalled;
+
+    start = currentTime();
+    for (int w = 0; w < numWorkers; w++) {
+        waitingFor[w] = -1;
+        snprintf(workerArg[w], sizeof(workerArg[w]), "%d", w);
+        fork1("Worker", Worker, workerArg[w], USLOSS_MIN_STACK, 4);
+    }
+
+    // runs again only once every worker has quit or is blocked
+    end = currentTime();
+
+    int recorded = numOps > 0 ? ops[numOps - 1].time - ops[0].time : 0;
+    USLOSS_Console("replay: %d ops from %d processes, %d skipped\n",
+                   numOps, numWorkers, skipped);
+    USLOSS_Console("replay: %d us replayed, %d us recorded, %.3f us/op\n",
+                   end - start, recorded,
+                   numOps > 0 ? (double)(end - start) / numOps : 0.0);
+    stalled = turn < numOps;
+    if (stalled)
+        USLOSS_Console("replay: stalled after %d ops\n", turn);
+
+    for (int i = 0; i < MAXMBOX; i++)
+        if (boxMap[i] >= 0)
+            MboxRelease(boxMap[i]);
+    turn = numOps;
+    for (int w = 0; w < numWorkers; w++)
+        if (waitingFor[w] >= 0)
+            unblockProc(workerPid[w]);
+
+    for (int w = 0; w < numWorkers; w++)
+        join(&status);
+
+    quit(stalled);
+}
+
+int Worker(char *arg)
+{
+    int w = atoi(arg);
+
+    // set here, not from fork1(), since a worker can block and need waking
+    // by a peer before fork1() returns to the driver
+    workerPid[w] = getpid();
+
+    for (int k = workerFirst[w]; k >= 0; k = ops[k].next) {
+        while (turn != k) {
+            if (turn >= numOps)
+                quit(0);
+            waitingFor[w] = k;
+            blockMe(REPLAY_BLOCKED);
+        }
+        waitingFor[w] = -1;
+
+        // pass the turn on before issuing, since the call may block
+        turn++;
+        if (turn < numOps) {
+            int next = ops[turn].worker;
+            if (next != w && waitingFor[next] == turn)
+                unblockProc(workerPid[next]);
+        }
+
+        issue(&ops[k]);
+    }
+
+    quit(0);
+}
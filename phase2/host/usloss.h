@@ -0,0 +1,62 @@
+/*
+ * Host build only: the subset of the USLOSS interface that phase 2, its
+ * testcases and the benchmarks use.  Values match USLOSS 4.7 where they are
+ * visible to phase 2; the device model behind them lives in host.c.
+ */
+
+#ifndef _USLOSS_H
+#define _USLOSS_H
+
+#define USLOSS_MIN_STACK            80000
+
+#define USLOSS_PSR_CURRENT_MODE     0x1
+#define USLOSS_PSR_CURRENT_INT      0x2
+#define USLOSS_PSR_PREV_MODE        0x4
+#define USLOSS_PSR_PREV_INT         0x8
+
+#define USLOSS_DEV_OK               0
+#define USLOSS_DEV_BUSY             1
+#define USLOSS_DEV_ERROR            2
+
+#define USLOSS_CLOCK_DEV            0
+#define USLOSS_ALARM_DEV            1
+#define USLOSS_DISK_DEV             2
+#define USLOSS_TERM_DEV             3
+
+#define USLOSS_CLOCK_INT            0
+#define USLOSS_ALARM_INT            1
+#define USLOSS_DISK_INT             2
+#define USLOSS_TERM_INT             3
+#define USLOSS_MMU_INT              4
+#define USLOSS_SYSCALL_INT          5
+#define USLOSS_ILLEGAL_INT          6
+#define USLOSS_NUM_INTS             7
+
+#define USLOSS_DISK_UNITS           2
+#define USLOSS_TERM_UNITS           4
+
+#define USLOSS_TERM_STAT_CHAR(status)   (((status) >> 8) & 0xff)
+#define USLOSS_TERM_STAT_RECV(status)   ((status) & 0x3)
+#define USLOSS_TERM_CTRL_RECV_INT(ctrl) ((ctrl) | 0x2)
+
+typedef struct USLOSS_Sysargs {
+    int   number;
+    void *arg1;
+    void *arg2;
+    void *arg3;
+    void *arg4;
+    void *arg5;
+} USLOSS_Sysargs;
+
+extern void (*USLOSS_IntVec[USLOSS_NUM_INTS])(int dev, void *arg);
+
+extern void         USLOSS_Console(char *format, ...);
+extern void         USLOSS_Halt(int status) __attribute__((__noreturn__));
+extern unsigned int USLOSS_PsrGet(void);
+extern int          USLOSS_PsrSet(unsigned int psr);
+extern int          USLOSS_DeviceInput(int dev, int unit, int *status);
+extern int          USLOSS_DeviceOutput(int dev, int unit, void *arg);
+extern void         USLOSS_Syscall(void *arg);
+extern void         USLOSS_WaitInt(void);
+
+#endif
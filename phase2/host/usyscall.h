@@ -0,0 +1,12 @@
+/*
+ * Host build only: the system call table size shared with phase 2.
+ */
+
+#ifndef _USYSCALL_H
+#define _USYSCALL_H
+
+#include <usloss.h>
+
+#define MAXSYSCALLS 50
+
+#endif
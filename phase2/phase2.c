@@ -4,23 +4,238 @@
  * INSTRUCTOR: Russell Lewis
  * ASSIGNMENT: Phase2
  * DUE_DATE:   03/02/2023
- * 
+ *
  * This project implements a mailbox system for IPC. It handles both the sending
- * and receiving of messages with or without payload as a way to mimic process 
- * communication in an operating system. 
+ * and receiving of messages with or without payload as a way to mimic process
+ * communication in an operating system.
  */
 
 // ----- Includes
 #include <usloss.h>
-#include <phase2.h> 
+#include <phase1.h>
+#include <phase2.h>
+#include "phase2_config.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+// ----- Constants
+#define CLOCK_BOX       0
+#define DISK_BOX        1
+#define TERM_BOX        3
+#define NUM_DEVICE_BOX  7
+
+#define CLOCK_PERIOD    100000 // microseconds between clock mailbox messages
+
+#define LOWEST_PRIORITY 5      // lowest priority a testcase process can fork at
+
+/* Optional phase 1 extension for priority inheritance: runs pid at the given
+ * priority until called again with 0. libphase1 does not provide it, so
+ * under USLOSS inheritance only reorders MBOX_WAKE_PRIORITY queues; the host
+ * build's host.c implements it in its scheduler.
+ */
+extern void inheritPriority(int pid, int priority) __attribute__((weak));
+
+
 // typedefs
+typedef struct Slot Slot;
+typedef struct Mailbox Mailbox;
+typedef struct ShadowProc ShadowProc;
+typedef struct WaitQueue WaitQueue;
+typedef struct Semaphore Semaphore;
+typedef struct Barrier Barrier;
+typedef struct EventGroup EventGroup;
+typedef struct Subscriber Subscriber;
+typedef struct Topic Topic;
 
 // ----- Structs
 
+/**
+ * A single queued message. Slots come from the system-wide pool of MAXSLOTS
+ * and are kept on a free list while unused. On a broadcast mailbox one slot
+ * is shared by every subscriber, and refCount is the number of subscribers
+ * that have not read it yet. A slot may also carry no payload of its own
+ * and point at a shared, refcounted payload slot instead (topic publish).
+ * A queued slot is linked both into its lane and into the list of queued
+ * slots with its tag, so either can give it up in O(1). A slot lent out by
+ * MboxRecvLoan() is in no mailbox; each loan holds one reference to it.
+ */
+struct Slot {
+    int   msgSize;
+    int   refCount;
+    int   sendTime;     // currentTime() when the message was sent
+    int   lane;
+    int   tag;
+    int   ref;          // msg is an MboxRef sent with MboxSendRef()
+    int   loans;        // outstanding MboxRecvLoan() loans of msg
+    char  msg[MAX_MESSAGE];
+    Slot *payload;
+    Slot *next;
+    Slot *prev;
+    Slot *tagNext;
+    Slot *tagPrev;
+#if PHASE2_SLOT_ALLOC == SLOT_ALLOC_ARENA
+    int   allocated;
+#endif
+};
+
+/**
+ * Phase 2's view of a process that is blocked on a mailbox. The sender or
+ * receiver on the other end fills in the result before unblocking it.
+ */
+struct ShadowProc {
+    int         pid;
+    void       *msgPtr;
+    int         msgSize;    // size of the message (send) or buffer (recv)
+    int         waitMask;   // event bits we are waiting for
+    int         sendTime;   // when a blocked producer called MboxSend()
+    int         result;
+    unsigned    waitSeq;    // arrival order on a mailbox wait queue
+    int         waitKey;    // priority on a MBOX_WAKE_PRIORITY queue, else 0
+    int         priority;   // declared with MboxSetPriority()
+    int         priorityPid; // pid that declared it, to ignore stale entries
+    int         inherited;  // priority lent by a blocked sender, 0 if none
+    int         inheritedPid;
+    int         boostTarget; // pid this blocked sender lent its priority to
+    int         inverted;   // blocked behind a lower-priority receiver
+    int         lane;       // lane a blocked sender's message goes to
+    int         tag;        // tag of a blocked sender's message, or of
+                            // the one handed to a blocked receiver
+    int         ref;        // a blocked sender's message is an MboxRef; for
+                            // a receiver whether it takes one (-1 either),
+                            // then whether the one handed to it was
+    int         loan;       // blocked in MboxRecvLoan()
+    int         forward;    // blocked in MboxForward(), takes only messages
+                            // of up to msgSize bytes
+    Slot       *loanSlot;   // the slot a sender lent it
+    ShadowProc *next;
+};
+
+/**
+ * The processes blocked on one end of a mailbox. waitPop() returns the
+ * waiter with the smallest (waitKey, waitSeq): the earliest arrival, or on a
+ * byPriority queue the earliest arrival of the best priority.
+ * PHASE2_WAIT_QUEUE picks whether that is the root of a heap or the head
+ * of a list kept in that order.
+ */
+struct WaitQueue {
+    int         count;
+    int         byPriority;
+#if PHASE2_WAIT_QUEUE == WAITQ_HEAP
+    ShadowProc *heap[MAXPROC];
+#else
+    ShadowProc *head;
+    ShadowProc *tail;
+#endif
+};
+
+/**
+ * A mailbox. Queued messages live in the slot list, except for zero-length
+ * messages that arrive while the slot list is empty; those are just counted
+ * in numTokens, so pure signaling boxes never touch the slot pool. Tokens
+ * are always older than any queued slot, which keeps delivery FIFO.
+ *
+ * A box made by MboxCreatePrio() has one slot list per lane, and bit i of
+ * laneMask is set while lane i is non-empty, so the receiver finds the
+ * highest queued lane in O(1). Other boxes only use lane 0. Lane boxes
+ * never count tokens, since a token can't overtake a queued slot.
+ *
+ * Queued slots are also indexed by tag, oldest first, and processes in
+ * MboxRecvTag() wait on the list for their tag rather than in consumers.
+ * Tokens are untagged, so they count as tag 0.
+ *
+ * A splice link sends the messages that match its filter on to another
+ * mailbox as they arrive, without waking anyone; the sender acts as if it
+ * had sent to the last mailbox of the chain.
+ */
+struct Mailbox {
+    int         inUse;
+    int         released;
+    int         generation; // bumped each time the id is reused
+    int         numSlots;
+    int         slotSize;
+    int         lastReceiver; // pid of the latest MboxRecv() caller
+    int         numQueued;  // tokens + slots, bounded by numSlots
+    int         numTokens;
+    int         numLanes;
+    unsigned    laneMask;
+    Slot       *slotHead[MBOX_MAX_LANES];
+    Slot       *slotTail[MBOX_MAX_LANES];
+    Slot       *tagHead[MBOX_MAX_TAGS];
+    Slot       *tagTail[MBOX_MAX_TAGS];
+    ShadowProc *tagWaiterHead[MBOX_MAX_TAGS];
+    ShadowProc *tagWaiterTail[MBOX_MAX_TAGS];
+    WaitQueue   producers;
+    WaitQueue   consumers;
+    int         spliceTo;   // mailbox matching sends go to, or -1
+    int         spliceTag;  // -1 for any tag
+    int         spliceMaxSize; // -1 for any size
+    int         broadcast;
+    int         numSubscribers;
+    Subscriber *subscribers;
+    MboxStatsInfo stats;
+};
+
+/**
+ * A process subscribed to a broadcast mailbox. cursor is the oldest message
+ * it has not read yet, or NULL when it is caught up.
+ */
+struct Subscriber {
+    int         pid;
+    int         blocked;
+    Slot       *cursor;
+    Subscriber *next;
+};
+
+/**
+ * A counting semaphore. V() hands the unit straight to the oldest waiter
+ * instead of bumping the count, so waiters are served strictly FIFO.
+ */
+struct Semaphore {
+    int         inUse;
+    int         value;
+    ShadowProc *waiterHead;
+    ShadowProc *waiterTail;
+};
+
+/**
+ * A reusable barrier for a fixed number of processes. The last arrival
+ * wakes every waiter in one pass and resets the barrier for the next phase.
+ */
+struct Barrier {
+    int         inUse;
+    int         count;
+    int         arrived;
+    ShadowProc *waiterHead;
+    ShadowProc *waiterTail;
+};
+
+/**
+ * A word of event flags. EventSet() wakes every waiter whose mask overlaps
+ * the flags; flags stay set until EventClear().
+ */
+struct EventGroup {
+    int         inUse;
+    int         flags;
+    ShadowProc *waiterHead;
+    ShadowProc *waiterTail;
+};
+
+/**
+ * A named publish/subscribe topic. Each subscription is an ordinary
+ * mailbox owned by the subscriber; drops counts publishes that found that
+ * mailbox full. subGen is the mailbox's generation when it subscribed, so
+ * a publish never reaches a new mailbox that reused a released id.
+ */
+struct Topic {
+    int  inUse;
+    char name[MAXTOPICNAME];
+    int  numSubs;
+    int  subMbox[MAXTOPICSUBS];
+    int  subGen[MAXTOPICSUBS];
+    int  subDrops[MAXTOPICSUBS];
+};
+
 // ----- Function Prototypes
 // Phase 2 Bootload
 void phase2_init(void);
@@ -28,100 +243,2751 @@ void phase2_start_service_processes(void);
 int phase2_check_io(void);
 void phase2_clockHandler(void);
 
-// Messaging System 
+// Messaging System
 int MboxCreate(int slots,int slot_size);
 int MboxRelease(int mbox_id);
 int MboxSend(int mbox_id, void *msg_ptr,int msg_size);
 int MboxRecv(int mbox_id, void *msg_ptr,int msg_max_size);
 int MboxCondSend(int mbox_id, void *msg_ptr,int msg_size);
 int MboxCondRecv(int mbox_id, void *msg_ptr,int msg_max_size);
+int MboxSetWakePolicy(int mbox_id, int policy);
+int MboxSetPriority(int priority);
+int MboxCreatePrio(int slots, int slot_size, int nlanes);
+int MboxSendPrio(int mbox_id, void *msg_ptr, int msg_size, int lane);
+int MboxSendTag(int mbox_id, void *msg_ptr, int msg_size, int tag);
+int MboxRecvTag(int mbox_id, int tag, void *msg_ptr, int msg_max_size);
+int MboxRecvLoan(int mbox_id, void **msg_ptr);
+int MboxReturnLoan(void *msg_ptr);
+int MboxSendRef(int mbox_id, void *buf, int len);
+int MboxRecvRef(int mbox_id, void **buf);
+int MboxForward(int src_id, int dst_id);
+int MboxCondForward(int src_id, int dst_id);
+int MboxSplice(int src_id, int dst_id, int tag, int max_size);
+int MboxUnsplice(int src_id);
+int MboxCreateBroadcast(int slots, int slot_size);
+int MboxSubscribe(int mbox_id);
+int MboxUnsubscribe(int mbox_id);
+int MboxStats(int mbox_id, MboxStatsInfo *stats);
+int MboxLatencyPercentile(MboxStatsInfo *stats, int percent);
+void MboxLatencyReport(void);
+void MboxDump(void);
+void KernelStats(KernelStatsInfo *stats);
+
+// Topics
+int TopicCreate(char *name);
+int TopicLookup(char *name);
+int TopicSubscribe(int topic_id, int mbox_id);
+int TopicUnsubscribe(int topic_id, int mbox_id);
+int TopicPublish(int topic_id, void *msg_ptr, int msg_size);
+int TopicDrops(int topic_id, int mbox_id);
 void waitDevice(int type,int unit,int *status);
 void wakeupByDevice(int type,int unit,int status);
 
-// is this supposed to be here ?? void (*systemCallVec[])(USLOSS_Sysargs *args);
+// Semaphores
+int SemCreate(int value);
+int SemFree(int sem_id);
+int SemP(int sem_id);
+int SemV(int sem_id);
+
+// Barriers and event flags
+int BarrierCreate(int count);
+int BarrierFree(int barrier_id);
+int BarrierWait(int barrier_id);
+int EventCreate(void);
+int EventFree(int event_id);
+int EventSet(int event_id, int bits);
+int EventClear(int event_id, int bits);
+int EventWait(int event_id, int mask);
+
+// Helpers
+static int MboxCreate_helper(int slots, int slot_size, int nlanes, int broadcast);
+static int MboxSend_helper(int mbox_id, void *msg_ptr, int msg_size, int lane, int tag, int ref,
+                           int conditional);
+static int MboxRecv_helper(int mbox_id, void *msg_ptr, int msg_max_size, int tag, int ref,
+                           Slot **loan, int conditional);
+static int MboxForward_helper(int src_id, int dst_id, int conditional);
+static void wakeAll(ShadowProc *list, int result);
+static int enqueueMessage(Mailbox *box, void *msg_ptr, int msg_size, int sendTime, int lane, int tag,
+                          int ref);
+static int dequeueMessage(Mailbox *box, int tag, int ref, void *msg_ptr, int msg_max_size);
+static Slot *detachMessage(Mailbox *box, int tag);
+static Slot *lendSlot(Slot *slot);
+static int copyToLoan(void *msg_ptr, int msg_size, Slot **loan);
+static int peekMessage(Mailbox *box, int *tag);
+static int canAccept(Mailbox *box, int tag);
+static ShadowProc *waitingConsumer(Mailbox *box, int tag, int msg_size, ShadowProc **wakeHead,
+                                   ShadowProc **wakeTail);
+static Mailbox *spliceTarget(Mailbox *box, int msg_size, int tag);
+static void countSpliced(Mailbox *box, Mailbox *target, int msg_size, int tag);
+static int hasTagged(Mailbox *box, int tag);
+static int enqueueShared(Mailbox *box, Slot *payload);
+static void appendSlot(Mailbox *box, Slot *slot, int lane);
+static Slot *unlinkSlot(Mailbox *box, Slot *slot);
+static int topLane(Mailbox *box);
+static void handOff(Mailbox *box, ShadowProc *consumer, void *msg_ptr, int msg_size, int tag, int ref,
+                    int sendTime);
+static void recordLatency(Mailbox *box, int delay);
+static void refillFromProducer(Mailbox *box);
+static ShadowProc *takeProducer(Mailbox *box, int tag);
+static int broadcastMessage(Mailbox *box, void *msg_ptr, int msg_size, int sendTime);
+static int recvBroadcast(Mailbox *box, Subscriber *sub, void *msg_ptr, int msg_max_size);
+static void reclaimReadSlots(Mailbox *box);
+static Subscriber *findSubscriber(Mailbox *box, int pid);
+static Slot *allocSlot(void);
+static void freeSlot(Slot *slot);
+static char *slotData(Slot *slot);
+static Topic *getTopic(int topic_id);
+static int dropSubscription(Topic *topic, int mbox_id);
+static Mailbox *getMailbox(int mbox_id);
+static void addWaiter(ShadowProc **head, ShadowProc **tail, ShadowProc *proc);
+static ShadowProc *popWaiter(ShadowProc **head, ShadowProc **tail);
+static int waitsBefore(ShadowProc *a, ShadowProc *b);
+static int ownPriority(int pid);
+static int priorityOf(int pid);
+static void lendPriority(Mailbox *box, ShadowProc *sender);
+static void dropInheritance(ShadowProc *sender);
+static int lentPriority(int pid);
+static void waitPush(WaitQueue *queue, ShadowProc *proc);
+static void waitInsert(WaitQueue *queue, ShadowProc *proc);
+static void waitRekey(WaitQueue *queue, int byPriority);
+static ShadowProc *waitPop(WaitQueue *queue);
+static ShadowProc *waitAt(WaitQueue *queue, int index);
+static void blockOn(int reason, int id);
+static void wakeUp(int pid);
+static void checkKernelMode(const char *func);
+static int disableInterrupts(void);
+static void restoreInterrupts(int psr);
+static void diskHandler(int dev, void *arg);
+static void termHandler(int dev, void *arg);
+static void syscallHandler(int dev, void *arg);
+static void nullsys(USLOSS_Sysargs *args);
 
 // ----- Global data structures/vars
+void (*systemCallVec[MAXSYSCALLS])(USLOSS_Sysargs *args);
+
+static Mailbox    mailboxes[MAXMBOX];
+static Slot       slotPool[MAXSLOTS];
+static Slot      *freeSlots;
+static int        slotsInUse;
+static int        arenaNext;    // where the next-fit sweep resumes
+static unsigned   waitSeqNext;
+static ShadowProc shadowTable[MAXPROC];
+static Subscriber subscriberPool[MAXSUBSCRIBERS];
+static Subscriber *freeSubscribers;
+static Semaphore  semaphores[MAXSEMS];
+static Barrier    barriers[MAXBARRIERS];
+static EventGroup eventGroups[MAXEVENTS];
+static Topic      topics[MAXTOPICS];
+
+static int        numWaitingIO;
+static int        lastClockTime;
+static KernelStatsInfo kernelStats;
 
 /**
- * 
+ * Initializes the mailbox table, the slot pool and the system call vector,
+ * installs the disk, terminal and syscall interrupt handlers, and creates the
+ * seven device mailboxes (clock, 2 disks, 4 terminals) as ids 0 through 6.
  */
 void phase2_init(void) {
+    checkKernelMode(__func__);
+
+    memset(mailboxes, 0, sizeof(mailboxes));
+    memset(shadowTable, 0, sizeof(shadowTable));
+    memset(semaphores, 0, sizeof(semaphores));
+    memset(barriers, 0, sizeof(barriers));
+    memset(eventGroups, 0, sizeof(eventGroups));
+    memset(topics, 0, sizeof(topics));
+
+    freeSlots = NULL;
+    for (int i = MAXSLOTS - 1; i >= 0; i--) {
+        slotPool[i].next = freeSlots;
+        freeSlots = &slotPool[i];
+#if PHASE2_SLOT_ALLOC == SLOT_ALLOC_ARENA
+        slotPool[i].allocated = 0;
+#endif
+    }
+    slotsInUse = 0;
+    arenaNext = 0;
+    waitSeqNext = 0;
 
+    freeSubscribers = NULL;
+    for (int i = MAXSUBSCRIBERS - 1; i >= 0; i--) {
+        subscriberPool[i].next = freeSubscribers;
+        freeSubscribers = &subscriberPool[i];
+    }
+
+    for (int i = 0; i < MAXSYSCALLS; i++) {
+        systemCallVec[i] = nullsys;
+    }
+
+    USLOSS_IntVec[USLOSS_DISK_INT]    = diskHandler;
+    USLOSS_IntVec[USLOSS_TERM_INT]    = termHandler;
+    USLOSS_IntVec[USLOSS_SYSCALL_INT] = syscallHandler;
+
+    for (int i = 0; i < NUM_DEVICE_BOX; i++) {
+        MboxCreate(1, sizeof(int));
+    }
+
+    numWaitingIO = 0;
+    lastClockTime = 0;
+    memset(&kernelStats, 0, sizeof(kernelStats));
 }
 
 /**
- * 
+ * Phase 2 has no service processes. Processes exist from here on, so this
+ * is where tracing starts.
  */
 void phase2_start_service_processes(void) {
-
+    traceStart();
 }
 
 /**
- * test
+ * Returns nonzero if any process is blocked in waitDevice(), so that the
+ * sentinel knows the system is not deadlocked.
  */
 int phase2_check_io(void) {
-    return 0;
+    return numWaitingIO > 0;
 }
 
 /**
- * 
+ * Called by phase 1 on every clock interrupt. Roughly every 100ms, the
+ * current time is conditionally sent to the clock device mailbox.
  */
 void phase2_clockHandler(void) {
+    int now = currentTime();
+    kernelStats.interrupts++;
+    traceEvent(TRACE_CLOCK, 0, 0);
 
+    if (now - lastClockTime >= CLOCK_PERIOD) {
+        int status;
+        USLOSS_DeviceInput(USLOSS_CLOCK_DEV, 0, &status);
+        MboxCondSend(CLOCK_BOX, &status, sizeof(int));
+        lastClockTime = now;
+    }
 }
 
 /**
- * 
+ * Creates a new mailbox with the given number of slots and maximum message
+ * size. Returns the id of the new mailbox, or -1 if the arguments are
+ * invalid or there are no free mailboxes.
  */
 int MboxCreate(int slots, int slot_size) {
-    return 0;
+    return MboxCreate_helper(slots, slot_size, 1, 0);
+}
+
+/**
+ * Common implementation of MboxCreate(), MboxCreatePrio() and
+ * MboxCreateBroadcast().
+ */
+static int MboxCreate_helper(int slots, int slot_size, int nlanes, int broadcast) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+    kernelStats.mboxOps++;
+
+    if (slots < 0 || slots > MAXSLOTS || slot_size < 0 || slot_size > MAX_MESSAGE) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    for (int id = 0; id < MAXMBOX; id++) {
+        Mailbox *box = &mailboxes[id];
+        if (!box->inUse) {
+            int generation = box->generation + 1;
+            memset(box, 0, sizeof(Mailbox));
+            box->inUse = 1;
+            box->generation = generation;
+            box->numSlots = slots;
+            box->slotSize = slot_size;
+            box->numLanes = nlanes;
+            box->spliceTo = -1;
+            box->broadcast = broadcast;
+            traceEvent(TRACE_CREATE, id, slot_size);
+            if (broadcast) {
+                recordCall(RECORD_BROADCAST, id, slot_size, slots, 0);
+            } else if (nlanes > 1) {
+                recordCall(RECORD_CREATEPRIO, id, slot_size, slots, nlanes);
+            } else {
+                recordCall(RECORD_CREATE, id, slot_size, slots, 0);
+            }
+
+            restoreInterrupts(psr);
+            return id;
+        }
+    }
+
+    restoreInterrupts(psr);
+    return -1;
 }
 
 /**
- * 
+ * Destroys a mailbox. All queued messages are freed and every process
+ * blocked on the mailbox is woken up and returns -3. The buffers behind
+ * queued MboxSendRef() references are not freed, since the kernel doesn't
+ * know how they were allocated: they are lost along with their slots, so
+ * a mailbox carrying references should be drained first. (A sender still
+ * blocked in MboxSendRef() gets -3 and keeps its buffer.) The mailbox is
+ * also dropped from every topic it was subscribed to. Returns 0 on
+ * success, -1 if the mailbox id is not in use.
  */
 int MboxRelease(int mbox_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+    kernelStats.mboxOps++;
+    recordCall(RECORD_RELEASE, mbox_id, 0, 0, 0);
+
+    Mailbox *box = getMailbox(mbox_id);
+    if (box == NULL) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    box->released = 1;
+    traceEvent(TRACE_RELEASE, mbox_id, 0);
+
+    for (int id = 0; id < MAXMBOX; id++) {
+        if (mailboxes[id].inUse && mailboxes[id].spliceTo == mbox_id) {
+            mailboxes[id].spliceTo = -1;
+        }
+    }
+    for (int id = 0; id < MAXTOPICS; id++) {
+        if (topics[id].inUse) {
+            dropSubscription(&topics[id], mbox_id);
+        }
+    }
+
+    for (int lane = 0; lane < box->numLanes; lane++) {
+        while (box->slotHead[lane] != NULL) {
+            freeSlot(unlinkSlot(box, box->slotHead[lane]));
+        }
+    }
+    box->numTokens = 0;
+    box->numQueued = 0;
+
+    while (box->subscribers != NULL) {
+        Subscriber *sub = box->subscribers;
+        box->subscribers = sub->next;
+        sub->next = freeSubscribers;
+        freeSubscribers = sub;
+    }
+    box->numSubscribers = 0;
+
+    ShadowProc *proc;
+    while ((proc = waitPop(&box->producers)) != NULL) {
+        dropInheritance(proc);
+        proc->result = -3;
+        wakeUp(proc->pid);
+    }
+    while ((proc = waitPop(&box->consumers)) != NULL) {
+        proc->result = -3;
+        wakeUp(proc->pid);
+    }
+    for (int tag = 0; tag < MBOX_MAX_TAGS; tag++) {
+        while ((proc = popWaiter(&box->tagWaiterHead[tag], &box->tagWaiterTail[tag])) != NULL) {
+            proc->result = -3;
+            wakeUp(proc->pid);
+        }
+    }
+
+    box->inUse = 0;
+
+    restoreInterrupts(psr);
     return 0;
 }
 
 /**
- * 
+ * Sends a message to a mailbox, blocking while the mailbox is full. Returns
+ * 0 on success, -1 on invalid arguments, -2 if the system is out of slots,
+ * and -3 if the mailbox was released while we were blocked.
  */
 int MboxSend(int mbox_id, void *msg_ptr, int msg_size) {
-    return 0;
+    recordCall(RECORD_SEND, mbox_id, msg_size, 0, 0);
+    return MboxSend_helper(mbox_id, msg_ptr, msg_size, 0, 0, 0, 0);
 }
 
 /**
- * 
+ * Receives a message from a mailbox, blocking until one is available.
+ * Returns the size of the message, -1 on invalid arguments or if the
+ * buffer is too small or the message is a reference sent with
+ * MboxSendRef(), and -3 if the mailbox was released.
  */
 int MboxRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
-    return 0;
+    recordCall(RECORD_RECV, mbox_id, msg_max_size, 0, 0);
+    return MboxRecv_helper(mbox_id, msg_ptr, msg_max_size, -1, 0, NULL, 0);
 }
 
 /**
- * 
+ * Same as MboxSend(), but returns -2 instead of blocking.
  */
 int MboxCondSend(int mbox_id, void *msg_ptr, int msg_size) {
-    return 0;
+    recordCall(RECORD_CONDSEND, mbox_id, msg_size, 0, 0);
+    return MboxSend_helper(mbox_id, msg_ptr, msg_size, 0, 0, 0, 1);
 }
 
 /**
- * 
+ * Same as MboxRecv(), but returns -2 instead of blocking.
  */
 int MboxCondRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
+    recordCall(RECORD_CONDRECV, mbox_id, msg_max_size, 0, 0);
+    return MboxRecv_helper(mbox_id, msg_ptr, msg_max_size, -1, 0, NULL, 1);
+}
+
+/**
+ * Chooses which blocked process a mailbox wakes first, for both senders and
+ * receivers: the earliest arrival (MBOX_WAKE_FIFO, the default), or the one
+ * with the best priority declared through MboxSetPriority(), earliest
+ * arrival first within a priority (MBOX_WAKE_PRIORITY). Processes already
+ * blocked are re-keyed and reordered under the new policy, keeping their
+ * arrival order. Returns 0, or -1 on invalid args.
+ */
+int MboxSetWakePolicy(int mbox_id, int policy) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    Mailbox *box = getMailbox(mbox_id);
+    if (box == NULL || (policy != MBOX_WAKE_FIFO && policy != MBOX_WAKE_PRIORITY)) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    waitRekey(&box->producers, policy == MBOX_WAKE_PRIORITY);
+    waitRekey(&box->consumers, policy == MBOX_WAKE_PRIORITY);
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Records the calling process's phase 1 priority (1 is highest) for
+ * MBOX_WAKE_PRIORITY mailboxes. Phase 1 offers no way to look a priority
+ * up, so processes that never call this rank below everyone else.
+ * Returns 0, or -1 if the priority is out of range.
+ */
+int MboxSetPriority(int priority) {
+    checkKernelMode(__func__);
+    if (priority < 1 || priority > LOWEST_PRIORITY) {
+        return -1;
+    }
+
+    int psr = disableInterrupts();
+    ShadowProc *self = &shadowTable[getpid() % MAXPROC];
+    self->priority = priority;
+    self->priorityPid = getpid();
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Creates a mailbox with nlanes priority lanes. Messages sent with
+ * MboxSendPrio() to a higher lane are received before anything queued in a
+ * lower one, so control messages overtake bulk data; within a lane order
+ * is FIFO. slots bounds the messages queued across all lanes, and senders
+ * blocked on a full box still get in in wake order. Returns the id of the
+ * new mailbox, or -1 on invalid args.
+ */
+int MboxCreatePrio(int slots, int slot_size, int nlanes) {
+    if (nlanes < 1 || nlanes > MBOX_MAX_LANES) {
+        return -1;
+    }
+    return MboxCreate_helper(slots, slot_size, nlanes, 0);
+}
+
+/**
+ * Same as MboxSend(), but queues the message in the given lane of a
+ * mailbox made by MboxCreatePrio(). Returns -1 also if the lane is not
+ * below the mailbox's lane count.
+ */
+int MboxSendPrio(int mbox_id, void *msg_ptr, int msg_size, int lane) {
+    recordCall(RECORD_SENDPRIO, mbox_id, msg_size, lane, 0);
+    return MboxSend_helper(mbox_id, msg_ptr, msg_size, lane, 0, 0, 0);
+}
+
+/**
+ * Same as MboxSend(), but the message carries the given tag, so that
+ * MboxRecvTag() can pick it out of the queue. Returns -1 also if the tag is
+ * out of range.
+ */
+int MboxSendTag(int mbox_id, void *msg_ptr, int msg_size, int tag) {
+    recordCall(RECORD_SENDTAG, mbox_id, msg_size, tag, 0);
+    return MboxSend_helper(mbox_id, msg_ptr, msg_size, 0, tag, 0, 0);
+}
+
+/**
+ * Receives the oldest queued message with the given tag, skipping over the
+ * others. Lookup is O(1) through the mailbox's per-tag index. If none is
+ * queued, the message is taken from the first sender blocked on the full
+ * mailbox with that tag, which keeps each tag FIFO; only if there is none
+ * either does the caller block until one arrives. Zero-slot and broadcast
+ * mailboxes are refused. Returns the size of the message, -1 on invalid
+ * args (including a negative tag) or if the buffer is too small, and -3 if
+ * the mailbox was released.
+ */
+int MboxRecvTag(int mbox_id, int tag, void *msg_ptr, int msg_max_size) {
+    recordCall(RECORD_RECVTAG, mbox_id, msg_max_size, tag, 0);
+    if (tag < 0) {
+        return -1;
+    }
+    return MboxRecv_helper(mbox_id, msg_ptr, msg_max_size, tag, 0, NULL, 0);
+}
+
+/**
+ * Receives the next message of a mailbox without copying it out: *msg_ptr
+ * is set to the message bytes in place, inside the slot they were queued
+ * in, and the slot stays out of the pool until MboxReturnLoan() gives it
+ * back. A message that was never queued, because it went straight from a
+ * sender to us, is copied into a fresh slot first. Zero-length messages
+ * set *msg_ptr to NULL and need no return. Blocks like MboxRecv(). Returns
+ * the size of the message, -1 on invalid args or a broadcast mailbox, -2
+ * if a slot was needed and none was free (the message is lost), and -3 if
+ * the mailbox was released.
+ */
+int MboxRecvLoan(int mbox_id, void **msg_ptr) {
+    recordCall(RECORD_RECV, mbox_id, MAX_MESSAGE, 0, 0);
+    if (msg_ptr == NULL) {
+        return -1;
+    }
+
+    Slot *loan = NULL;
+    int result = MboxRecv_helper(mbox_id, NULL, MAX_MESSAGE, -1, 0, &loan, 0);
+    *msg_ptr = loan != NULL ? loan->msg : NULL;
+    return result;
+}
+
+/**
+ * Gives back a message lent by MboxRecvLoan(); the slot returns to the pool
+ * once no mailbox or loan holds it any more. Returns 0, or -1 if msg_ptr is
+ * not the start of a message that is out on loan.
+ */
+int MboxReturnLoan(void *msg_ptr) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    char *ptr = msg_ptr;
+    if (ptr < (char *)slotPool || ptr >= (char *)(slotPool + MAXSLOTS)) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+    Slot *slot = &slotPool[(ptr - (char *)slotPool) / sizeof(Slot)];
+    if (ptr != slot->msg || slot->loans == 0) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    slot->loans--;
+    if (--slot->refCount == 0) {
+        freeSlot(slot);
+    }
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Sends a buffer by reference: only an MboxRef holding buf and len is
+ * queued, so the cost is the same whatever the length, and len may exceed
+ * MAX_MESSAGE. The buffer then belongs to whoever receives the reference;
+ * the sender must not touch or free it. Works on any mailbox whose slots
+ * hold an MboxRef, except broadcast mailboxes, whose subscribers can't all
+ * own the buffer. The message is marked as a reference, and keeps the mark
+ * through forwards and splices, so only MboxRecvRef() can take it.
+ * Returns as MboxSend(), and -1 also if len < 0 or buf is NULL with a
+ * non-zero len.
+ */
+int MboxSendRef(int mbox_id, void *buf, int len) {
+    recordCall(RECORD_SEND, mbox_id, sizeof(MboxRef), 0, 0);
+    if (len < 0 || (buf == NULL && len > 0)) {
+        return -1;
+    }
+
+    MboxRef ref = { buf, len };
+    return MboxSend_helper(mbox_id, &ref, sizeof(ref), 0, 0, 1, 0);
+}
+
+/**
+ * Receives a buffer reference sent with MboxSendRef(), blocking like
+ * MboxRecv(), and passes ownership of the buffer to the caller through
+ * *buf. Returns the buffer length, -1 on invalid args or if the message is
+ * not a reference (it is consumed anyway), and -3 if the mailbox was
+ * released.
+ */
+int MboxRecvRef(int mbox_id, void **buf) {
+    recordCall(RECORD_RECV, mbox_id, sizeof(MboxRef), 0, 0);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    MboxRef ref;
+    int result = MboxRecv_helper(mbox_id, &ref, sizeof(ref), -1, 1, NULL, 0);
+    if (result < 0) {
+        return result;
+    }
+
+    *buf = ref.ptr;
+    return ref.len;
+}
+
+/**
+ * Moves the next message of one mailbox to another, like MboxRecv() on
+ * src_id followed by MboxSend() of the same bytes to dst_id, but without
+ * copying the message out to the caller and back. A queued slot is
+ * unlinked from src_id and linked into dst_id as is, keeping its tag, and
+ * its lane if dst_id has one. The message is only copied when it goes to
+ * a process blocked on dst_id, or comes from one blocked on a zero-slot
+ * src_id. The caller blocks first as a receiver on src_id, then (holding
+ * the message) as a sender on dst_id; a message that arrives while it is
+ * blocked on src_id is copied twice, to the caller and then on to dst_id.
+ * Returns the size of the message, -1 on invalid args, including broadcast
+ * mailboxes and a message bigger than dst_id's slots (which is left in
+ * src_id, or with its sender if it had to wait for one), and -3 if either
+ * mailbox was released while we were blocked.
+ */
+int MboxForward(int src_id, int dst_id) {
+    recordCall(RECORD_RECV, src_id, MAX_MESSAGE, 0, 0);
+    return MboxForward_helper(src_id, dst_id, 0);
+}
+
+/**
+ * Same as MboxForward(), but returns -2, and leaves both mailboxes alone, if
+ * src_id has no message or dst_id has no room for it.
+ */
+int MboxCondForward(int src_id, int dst_id) {
+    recordCall(RECORD_CONDRECV, src_id, MAX_MESSAGE, 0, 0);
+    return MboxForward_helper(src_id, dst_id, 1);
+}
+
+/**
+ * Links one mailbox to another. Every later send to src_id, including a
+ * MboxForward() into it, of a message that has the given tag (any tag if
+ * tag < 0), is at most max_size bytes (any size if max_size < 0) and fits
+ * in dst_id's slots is delivered to dst_id instead, following dst_id's own
+ * link in turn. Nothing is scheduled to move it; the sender blocks, or
+ * fails a conditional send, on the last mailbox of the chain. Messages
+ * already queued in src_id stay there, as do the ones the filter rejects.
+ * A new link replaces the old one, and releasing either end removes it.
+ * Returns 0, or -1 on invalid args, if src_id is a broadcast mailbox, or if
+ * the link would close a loop.
+ */
+int MboxSplice(int src_id, int dst_id, int tag, int max_size) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    Mailbox *src = getMailbox(src_id);
+    Mailbox *dst = getMailbox(dst_id);
+    if (src == NULL || dst == NULL || src->released || dst->released || src->broadcast ||
+            tag >= MBOX_MAX_TAGS) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    for (int id = dst_id; id >= 0; id = mailboxes[id].spliceTo) {
+        if (id == src_id) {
+            restoreInterrupts(psr);
+            return -1;
+        }
+    }
+
+    src->spliceTo = dst_id;
+    src->spliceTag = tag < 0 ? -1 : tag;
+    src->spliceMaxSize = max_size < 0 ? -1 : max_size;
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Removes the splice link of a mailbox. Returns 0, or -1 if the mailbox is
+ * not in use or has no link.
+ */
+int MboxUnsplice(int src_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    Mailbox *src = getMailbox(src_id);
+    if (src == NULL || src->spliceTo < 0) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+    src->spliceTo = -1;
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Creates a broadcast mailbox: every message sent to it is stored once and
+ * delivered to every process subscribed at the time of the send. slots
+ * bounds how many messages may be waiting for the slowest subscriber.
+ * Returns the id of the new mailbox, or -1 on invalid args.
+ */
+int MboxCreateBroadcast(int slots, int slot_size) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (slots < 1) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    int mbox_id = MboxCreate_helper(slots, slot_size, 1, 1);
+
+    restoreInterrupts(psr);
+    return mbox_id;
+}
+
+/**
+ * Subscribes the current process to a broadcast mailbox; it will receive
+ * every message sent from now on. Returns 0 on success, -1 if the mailbox
+ * is not a broadcast mailbox, we are already subscribed, or there are no
+ * free subscriber entries.
+ */
+int MboxSubscribe(int mbox_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+    recordCall(RECORD_SUBSCRIBE, mbox_id, 0, 0, 0);
+
+    Mailbox *box = getMailbox(mbox_id);
+    if (box == NULL || box->released || !box->broadcast ||
+            findSubscriber(box, getpid()) != NULL || freeSubscribers == NULL) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Subscriber *sub = freeSubscribers;
+    freeSubscribers = sub->next;
+
+    sub->pid = getpid();
+    sub->blocked = 0;
+    sub->cursor = NULL;
+    sub->next = box->subscribers;
+    box->subscribers = sub;
+    box->numSubscribers++;
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Unsubscribes the current process from a broadcast mailbox, dropping its
+ * references to any messages it has not read. Returns 0 on success, -1 if
+ * we are not subscribed.
+ */
+int MboxUnsubscribe(int mbox_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+    recordCall(RECORD_UNSUBSCRIBE, mbox_id, 0, 0, 0);
+
+    Mailbox *box = getMailbox(mbox_id);
+    Subscriber *sub = (box == NULL || !box->broadcast) ? NULL : findSubscriber(box, getpid());
+    if (sub == NULL) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Subscriber **link = &box->subscribers;
+    while (*link != sub) {
+        link = &(*link)->next;
+    }
+    *link = sub->next;
+    box->numSubscribers--;
+
+    for (Slot *slot = sub->cursor; slot != NULL; slot = slot->next) {
+        slot->refCount--;
+    }
+    sub->next = freeSubscribers;
+    freeSubscribers = sub;
+
+    reclaimReadSlots(box);
+    refillFromProducer(box);
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Copies the statistics of a mailbox into *stats; depth is the number of
+ * messages queued right now. Returns 0 on success, -1 on invalid args.
+ */
+int MboxStats(int mbox_id, MboxStatsInfo *stats) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    Mailbox *box = getMailbox(mbox_id);
+    if (box == NULL || stats == NULL) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    *stats = box->stats;
+    stats->depth = box->numQueued;
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Returns the upper bound, in microseconds, of the latency bucket that
+ * holds the given percentile of a mailbox's send-to-receive delays, or -1
+ * if no deliveries have been timed.
+ */
+int MboxLatencyPercentile(MboxStatsInfo *stats, int percent) {
+    int total = 0;
+    for (int i = 0; i < MBOX_LATENCY_BUCKETS; i++) {
+        total += stats->latency[i];
+    }
+    if (total == 0 || percent < 0 || percent > 100) {
+        return -1;
+    }
+
+    // smallest bucket whose running count reaches percent of the samples
+    long needed = ((long)total * percent + 99) / 100;
+    long seen = 0;
+    for (int i = 0; i < MBOX_LATENCY_BUCKETS; i++) {
+        seen += stats->latency[i];
+        if (seen >= needed && seen > 0) {
+            return i == 0 ? 0 : (int)((1u << i) - 1);
+        }
+    }
+    return (int)((1u << (MBOX_LATENCY_BUCKETS - 1)) - 1);
+}
+
+/**
+ * Prints p50 and p99 send-to-receive latency for every mailbox in use
+ * that has timed at least one delivery.
+ */
+void MboxLatencyReport(void) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    USLOSS_Console("  ID  RECEIVES   P50(us)   P99(us)\n");
+    for (int id = 0; id < MAXMBOX; id++) {
+        Mailbox *box = &mailboxes[id];
+        if (!box->inUse || MboxLatencyPercentile(&box->stats, 100) < 0) {
+            continue;
+        }
+        USLOSS_Console("%4d  %8d  %8d  %8d\n", id, box->stats.receives,
+                       MboxLatencyPercentile(&box->stats, 50),
+                       MboxLatencyPercentile(&box->stats, 99));
+    }
+
+    restoreInterrupts(psr);
+}
+
+/**
+ * Prints every mailbox in use: its size, the messages queued on it, and
+ * the pids of the processes blocked sending to or receiving from it,
+ * followed by the usage of the system-wide slot pool.
+ */
+void MboxDump(void) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    USLOSS_Console("  ID  SLOTS  SLOT_SIZE  QUEUED  FLAGS\n");
+    for (int id = 0; id < MAXMBOX; id++) {
+        Mailbox *box = &mailboxes[id];
+        if (!box->inUse) {
+            continue;
+        }
+
+        USLOSS_Console("%4d  %5d  %9d  %6d  %s%s\n", id, box->numSlots, box->slotSize,
+                       box->numQueued, box->broadcast ? "broadcast " : "",
+                       box->released ? "released" : "");
+
+        if (box->spliceTo >= 0) {
+            USLOSS_Console("        spliced to %d (tag %d, max size %d)\n", box->spliceTo,
+                           box->spliceTag, box->spliceMaxSize);
+        }
+        if (box->numQueued > 0) {
+            USLOSS_Console("        messages:");
+            if (box->numTokens > 0) {
+                USLOSS_Console(" %d x 0 bytes (counted)", box->numTokens);
+            }
+            for (int lane = box->numLanes - 1; lane >= 0; lane--) {
+                if (box->numLanes > 1 && box->slotHead[lane] != NULL) {
+                    USLOSS_Console(" [lane %d]", lane);
+                }
+                for (Slot *slot = box->slotHead[lane]; slot != NULL; slot = slot->next) {
+                    USLOSS_Console(" %d", slot->msgSize);
+                }
+            }
+            USLOSS_Console("\n");
+        }
+        for (int tag = 0; tag < MBOX_MAX_TAGS; tag++) {
+            if (box->tagWaiterHead[tag] != NULL) {
+                USLOSS_Console("        blocked on tag %d:", tag);
+                for (ShadowProc *proc = box->tagWaiterHead[tag]; proc != NULL; proc = proc->next) {
+                    USLOSS_Console(" %d", proc->pid);
+                }
+                USLOSS_Console("\n");
+            }
+        }
+        if (box->producers.count > 0) {
+            USLOSS_Console("        blocked senders:");
+            for (int i = 0; i < box->producers.count; i++) {
+                USLOSS_Console(" %d", waitAt(&box->producers, i)->pid);
+            }
+            USLOSS_Console("\n");
+        }
+        if (box->consumers.count > 0) {
+            USLOSS_Console("        blocked receivers:");
+            for (int i = 0; i < box->consumers.count; i++) {
+                USLOSS_Console(" %d", waitAt(&box->consumers, i)->pid);
+            }
+            USLOSS_Console("\n");
+        }
+        if (box->subscribers != NULL) {
+            USLOSS_Console("        subscribers:");
+            for (Subscriber *sub = box->subscribers; sub != NULL; sub = sub->next) {
+                USLOSS_Console(" %d", sub->pid);
+            }
+            USLOSS_Console("\n");
+        }
+    }
+    USLOSS_Console("slots in use: %d / %d\n", slotsInUse, MAXSLOTS);
+
+    restoreInterrupts(psr);
+}
+
+/**
+ * Copies the system-wide phase 2 counters into *stats.
+ */
+void KernelStats(KernelStatsInfo *stats) {
+    int psr = disableInterrupts();
+    *stats = kernelStats;
+    restoreInterrupts(psr);
+}
+
+/**
+ * Creates a topic with the given name. Returns its id, or -1 if the name
+ * is empty, too long or already taken, or there are no free topics.
+ */
+int TopicCreate(char *name) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (name == NULL || name[0] == '\0' || strlen(name) >= MAXTOPICNAME ||
+            TopicLookup(name) >= 0) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    for (int id = 0; id < MAXTOPICS; id++) {
+        Topic *topic = &topics[id];
+        if (!topic->inUse) {
+            memset(topic, 0, sizeof(Topic));
+            topic->inUse = 1;
+            strcpy(topic->name, name);
+
+            restoreInterrupts(psr);
+            return id;
+        }
+    }
+
+    restoreInterrupts(psr);
+    return -1;
+}
+
+/**
+ * Returns the id of the topic with the given name, or -1 if there is none.
+ */
+int TopicLookup(char *name) {
+    checkKernelMode(__func__);
+
+    if (name == NULL) {
+        return -1;
+    }
+
+    for (int id = 0; id < MAXTOPICS; id++) {
+        if (topics[id].inUse && strcmp(topics[id].name, name) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Adds a mailbox to a topic; every later publish is queued on it. Returns
+ * 0 on success, -1 if either id is invalid, the mailbox is already
+ * subscribed, or the topic has no room for more subscribers.
+ */
+int TopicSubscribe(int topic_id, int mbox_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    Topic *topic = getTopic(topic_id);
+    Mailbox *box = getMailbox(mbox_id);
+    if (topic == NULL || box == NULL || box->broadcast || topic->numSubs == MAXTOPICSUBS) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    for (int i = 0; i < topic->numSubs; i++) {
+        if (topic->subMbox[i] == mbox_id) {
+            restoreInterrupts(psr);
+            return -1;
+        }
+    }
+
+    topic->subMbox[topic->numSubs] = mbox_id;
+    topic->subGen[topic->numSubs] = box->generation;
+    topic->subDrops[topic->numSubs] = 0;
+    topic->numSubs++;
+
+    restoreInterrupts(psr);
     return 0;
 }
 
 /**
- * 
+ * Removes a mailbox from a topic. Messages already queued on it stay
+ * there. Returns 0 on success, -1 if the mailbox was not subscribed.
+ */
+int TopicUnsubscribe(int topic_id, int mbox_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    Topic *topic = getTopic(topic_id);
+    int result = topic == NULL ? -1 : dropSubscription(topic, mbox_id);
+
+    restoreInterrupts(psr);
+    return result;
+}
+
+/**
+ * Publishes a message to every mailbox subscribed to a topic, without ever
+ * blocking. The payload is copied once into a shared slot that each
+ * subscriber's queue references; waiting receivers are handed a copy
+ * directly. A subscriber whose mailbox is full (or gone, or too small for
+ * the message) has the publish counted as a drop instead. All deliveries
+ * happen before any receiver is woken, so the publish is atomic.
+ * Returns the number of mailboxes that got the message, or -1 on invalid
+ * args.
+ */
+int TopicPublish(int topic_id, void *msg_ptr, int msg_size) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    Topic *topic = getTopic(topic_id);
+    if (topic == NULL || msg_size < 0 || msg_size > MAX_MESSAGE ||
+            (msg_ptr == NULL && msg_size > 0)) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Slot *payload = NULL;
+    ShadowProc *wakeHead = NULL, *wakeTail = NULL;
+    int delivered = 0;
+    int now = currentTime();
+
+    for (int i = 0; i < topic->numSubs; i++) {
+        Mailbox *box = getMailbox(topic->subMbox[i]);
+        if (box == NULL || box->released || box->generation != topic->subGen[i] ||
+                msg_size > box->slotSize) {
+            topic->subDrops[i]++;
+            continue;
+        }
+
+        // published messages carry tag 0
+        ShadowProc *consumer = waitingConsumer(box, 0, msg_size, &wakeHead, &wakeTail);
+        if (consumer != NULL) {
+            handOff(box, consumer, msg_ptr, msg_size, 0, 0, now);
+            addWaiter(&wakeHead, &wakeTail, consumer);
+            box->stats.sends++;
+            delivered++;
+            continue;
+        }
+
+        if (box->numQueued >= box->numSlots || box->producers.count > 0) {
+            topic->subDrops[i]++;
+            continue;
+        }
+
+        int result;
+        if (msg_size == 0) {
+            result = enqueueMessage(box, NULL, 0, now, 0, 0, 0);
+        } else {
+            if (payload == NULL) {
+                payload = allocSlot();
+                if (payload != NULL) {
+                    payload->msgSize = msg_size;
+                    payload->sendTime = now;
+                    memcpy(payload->msg, msg_ptr, msg_size);
+                    payload->refCount = 1;  // held by us until the loop ends
+                }
+            }
+            result = payload == NULL ? -2 : enqueueShared(box, payload);
+        }
+
+        if (result == 0) {
+            box->stats.sends++;
+            delivered++;
+        } else {
+            topic->subDrops[i]++;
+        }
+    }
+
+    if (payload != NULL && --payload->refCount == 0) {
+        freeSlot(payload);
+    }
+
+    while (wakeHead != NULL) {
+        ShadowProc *proc = wakeHead;
+        wakeHead = proc->next;
+        wakeUp(proc->pid);
+    }
+
+    restoreInterrupts(psr);
+    return delivered;
+}
+
+/**
+ * Returns how many publishes to a topic were dropped for the given
+ * subscriber mailbox, or -1 if it is not subscribed.
+ */
+int TopicDrops(int topic_id, int mbox_id) {
+    checkKernelMode(__func__);
+
+    Topic *topic = getTopic(topic_id);
+    if (topic == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < topic->numSubs; i++) {
+        if (topic->subMbox[i] == mbox_id) {
+            return topic->subDrops[i];
+        }
+    }
+    return -1;
+}
+
+/**
+ * Blocks the current process until the given device raises an interrupt,
+ * then stores the device's status register in *status.
  */
 void waitDevice(int type, int unit, int *status) {
+    checkKernelMode(__func__);
+
+    int mbox_id;
+    if (type == USLOSS_CLOCK_DEV && unit == 0) {
+        mbox_id = CLOCK_BOX;
+    } else if (type == USLOSS_DISK_DEV && unit >= 0 && unit < USLOSS_DISK_UNITS) {
+        mbox_id = DISK_BOX + unit;
+    } else if (type == USLOSS_TERM_DEV && unit >= 0 && unit < USLOSS_TERM_UNITS) {
+        mbox_id = TERM_BOX + unit;
+    } else {
+        USLOSS_Console("waitDevice(): Invalid device type %d or unit %d.\n", type, unit);
+        USLOSS_Halt(1);
+        return;
+    }
 
+    numWaitingIO++;
+    MboxRecv(mbox_id, status, sizeof(int));
+    numWaitingIO--;
+    traceEvent(TRACE_DEVICE, type, unit);
 }
 
 /**
- * 
+ * Unused in this phase; device interrupts are delivered by the handlers
+ * installed in phase2_init().
  */
 void wakeupByDevice(int type, int unit, int status) {
 
-}
\ No newline at end of file
+}
+
+/**
+ * Creates a semaphore with the given initial value. Returns its id, or -1
+ * if the value is negative or there are no free semaphores.
+ */
+int SemCreate(int value) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (value < 0) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    for (int id = 0; id < MAXSEMS; id++) {
+        Semaphore *sem = &semaphores[id];
+        if (!sem->inUse) {
+            memset(sem, 0, sizeof(Semaphore));
+            sem->inUse = 1;
+            sem->value = value;
+
+            restoreInterrupts(psr);
+            return id;
+        }
+    }
+
+    restoreInterrupts(psr);
+    return -1;
+}
+
+/**
+ * Destroys a semaphore. Every process blocked in SemP() is woken up and
+ * returns -3. Returns 0 on success, -1 if the id is not in use.
+ */
+int SemFree(int sem_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (sem_id < 0 || sem_id >= MAXSEMS || !semaphores[sem_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    // detach the waiters first: one that is woken may run at once and get
+    // this id back from SemCreate()
+    Semaphore *sem = &semaphores[sem_id];
+    ShadowProc *waiters = sem->waiterHead;
+    sem->inUse = 0;
+    sem->waiterHead = sem->waiterTail = NULL;
+    wakeAll(waiters, -3);
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Decrements the semaphore, blocking while its value is zero. Returns 0 on
+ * success, -1 on an invalid id, -3 if the semaphore was freed while we
+ * were blocked.
+ */
+int SemP(int sem_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (sem_id < 0 || sem_id >= MAXSEMS || !semaphores[sem_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Semaphore *sem = &semaphores[sem_id];
+    if (sem->value > 0) {
+        sem->value--;
+        restoreInterrupts(psr);
+        return 0;
+    }
+
+    ShadowProc *self = &shadowTable[getpid() % MAXPROC];
+    self->pid = getpid();
+    self->result = 0;
+    addWaiter(&sem->waiterHead, &sem->waiterTail, self);
+
+    blockOn(BLOCKED_SEM, sem_id);
+
+    restoreInterrupts(psr);
+    return self->result;
+}
+
+/**
+ * Increments the semaphore, or wakes the oldest process blocked in SemP().
+ * Returns 0 on success, -1 on an invalid id.
+ */
+int SemV(int sem_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (sem_id < 0 || sem_id >= MAXSEMS || !semaphores[sem_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Semaphore *sem = &semaphores[sem_id];
+    ShadowProc *waiter = popWaiter(&sem->waiterHead, &sem->waiterTail);
+    if (waiter == NULL) {
+        sem->value++;
+    } else {
+        waiter->result = 0;
+        wakeUp(waiter->pid);
+    }
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Creates a barrier that releases once count processes are waiting on it.
+ * Returns its id, or -1 if count < 1 or there are no free barriers.
+ */
+int BarrierCreate(int count) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (count < 1) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    for (int id = 0; id < MAXBARRIERS; id++) {
+        Barrier *barrier = &barriers[id];
+        if (!barrier->inUse) {
+            memset(barrier, 0, sizeof(Barrier));
+            barrier->inUse = 1;
+            barrier->count = count;
+
+            restoreInterrupts(psr);
+            return id;
+        }
+    }
+
+    restoreInterrupts(psr);
+    return -1;
+}
+
+/**
+ * Destroys a barrier; processes waiting on it return -3. Returns 0 on
+ * success, -1 if the id is not in use.
+ */
+int BarrierFree(int barrier_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (barrier_id < 0 || barrier_id >= MAXBARRIERS || !barriers[barrier_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Barrier *barrier = &barriers[barrier_id];
+    ShadowProc *waiters = barrier->waiterHead;
+    barrier->inUse = 0;
+    barrier->waiterHead = barrier->waiterTail = NULL;
+    wakeAll(waiters, -3);
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Blocks until count processes have called BarrierWait() on this barrier.
+ * Returns 0 when released, -1 on an invalid id, -3 if the barrier was freed.
+ */
+int BarrierWait(int barrier_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (barrier_id < 0 || barrier_id >= MAXBARRIERS || !barriers[barrier_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Barrier *barrier = &barriers[barrier_id];
+    barrier->arrived++;
+
+    // last one in, release this phase and reset for the next
+    if (barrier->arrived == barrier->count) {
+        ShadowProc *waiters = barrier->waiterHead;
+        barrier->arrived = 0;
+        barrier->waiterHead = barrier->waiterTail = NULL;
+        wakeAll(waiters, 0);
+
+        restoreInterrupts(psr);
+        return 0;
+    }
+
+    ShadowProc *self = &shadowTable[getpid() % MAXPROC];
+    self->pid = getpid();
+    self->result = 0;
+    addWaiter(&barrier->waiterHead, &barrier->waiterTail, self);
+
+    blockOn(BLOCKED_BARRIER, barrier_id);
+
+    restoreInterrupts(psr);
+    return self->result;
+}
+
+/**
+ * Creates an event group with all flags clear. Returns its id, or -1 if
+ * there are no free event groups.
+ */
+int EventCreate(void) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    for (int id = 0; id < MAXEVENTS; id++) {
+        EventGroup *group = &eventGroups[id];
+        if (!group->inUse) {
+            memset(group, 0, sizeof(EventGroup));
+            group->inUse = 1;
+
+            restoreInterrupts(psr);
+            return id;
+        }
+    }
+
+    restoreInterrupts(psr);
+    return -1;
+}
+
+/**
+ * Destroys an event group; processes waiting on it return -3. Returns 0 on
+ * success, -1 if the id is not in use.
+ */
+int EventFree(int event_id) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (event_id < 0 || event_id >= MAXEVENTS || !eventGroups[event_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    EventGroup *group = &eventGroups[event_id];
+    ShadowProc *waiters = group->waiterHead;
+    group->inUse = 0;
+    group->waiterHead = group->waiterTail = NULL;
+    wakeAll(waiters, -3);
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Sets the given flags and wakes every waiter whose mask now matches, in a
+ * single pass over the wait list. Returns 0, or -1 on an invalid id.
+ */
+int EventSet(int event_id, int bits) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (event_id < 0 || event_id >= MAXEVENTS || !eventGroups[event_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    EventGroup *group = &eventGroups[event_id];
+    group->flags |= bits;
+
+    // split the wait list into the processes to wake and those still waiting
+    ShadowProc *wakeHead = NULL, *wakeTail = NULL;
+    ShadowProc *waiters = group->waiterHead;
+    group->waiterHead = group->waiterTail = NULL;
+
+    while (waiters != NULL) {
+        ShadowProc *proc = waiters;
+        waiters = proc->next;
+
+        if (proc->waitMask & group->flags) {
+            proc->result = proc->waitMask & group->flags;
+            addWaiter(&wakeHead, &wakeTail, proc);
+        } else {
+            addWaiter(&group->waiterHead, &group->waiterTail, proc);
+        }
+    }
+
+    for (ShadowProc *proc = wakeHead; proc != NULL; ) {
+        ShadowProc *next = proc->next;
+        wakeUp(proc->pid);
+        proc = next;
+    }
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Clears the given flags. Returns 0, or -1 on an invalid id.
+ */
+int EventClear(int event_id, int bits) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (event_id < 0 || event_id >= MAXEVENTS || !eventGroups[event_id].inUse) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    eventGroups[event_id].flags &= ~bits;
+
+    restoreInterrupts(psr);
+    return 0;
+}
+
+/**
+ * Blocks until any of the flags in mask is set. Returns the matching flags,
+ * -1 on an invalid id or empty mask, -3 if the event group was freed.
+ */
+int EventWait(int event_id, int mask) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+
+    if (event_id < 0 || event_id >= MAXEVENTS || !eventGroups[event_id].inUse || mask == 0) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    EventGroup *group = &eventGroups[event_id];
+    if (group->flags & mask) {
+        restoreInterrupts(psr);
+        return group->flags & mask;
+    }
+
+    ShadowProc *self = &shadowTable[getpid() % MAXPROC];
+    self->pid = getpid();
+    self->waitMask = mask;
+    self->result = 0;
+    addWaiter(&group->waiterHead, &group->waiterTail, self);
+
+    blockOn(BLOCKED_EVENT, event_id);
+
+    restoreInterrupts(psr);
+    return self->result;
+}
+
+/**
+ * Common implementation of MboxSend() and MboxCondSend(). ref is set for
+ * an MboxRef sent with MboxSendRef().
+ */
+static int MboxSend_helper(int mbox_id, void *msg_ptr, int msg_size, int lane, int tag, int ref,
+                           int conditional) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+    kernelStats.mboxOps++;
+
+    Mailbox *box = getMailbox(mbox_id);
+    if (box == NULL || box->released || msg_size < 0 || msg_size > box->slotSize ||
+            (msg_ptr == NULL && msg_size > 0) || lane < 0 || lane >= box->numLanes ||
+            tag < 0 || tag >= MBOX_MAX_TAGS) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    Mailbox *linked = box;
+    box = spliceTarget(box, msg_size, tag);
+    mbox_id = box - mailboxes;
+    if (lane >= box->numLanes) {
+        lane = 0;
+    }
+    if (ref && box->broadcast) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    int result;
+    int hasRoom = box->numQueued < box->numSlots && box->producers.count == 0;
+    ShadowProc *consumer = box->broadcast ? NULL : waitingConsumer(box, tag, msg_size, NULL, NULL);
+
+    if (box->broadcast && hasRoom) {
+        result = broadcastMessage(box, msg_ptr, msg_size, currentTime());
+    } else if (consumer != NULL) {
+        // a consumer is already waiting, hand the message over directly,
+        // preferring one that asked for this tag
+        handOff(box, consumer, msg_ptr, msg_size, tag, ref, currentTime());
+        wakeUp(consumer->pid);
+        result = 0;
+    } else if (!box->broadcast && hasRoom) {
+        // room in the mailbox (and nobody ahead of us), queue the message
+        result = enqueueMessage(box, msg_ptr, msg_size, currentTime(), lane, tag, ref);
+        if (result == -2) {
+            USLOSS_Console("MboxSend_helper: Could not send, the system is out of mailbox slots.\n");
+        }
+    } else if (conditional) {
+        box->stats.condSendFails++;
+        result = -2;
+    } else {
+        // full (or zero-slot) mailbox, wait for a consumer to make room
+        ShadowProc *self = &shadowTable[getpid() % MAXPROC];
+        self->pid = getpid();
+        self->msgPtr = msg_ptr;
+        self->msgSize = msg_size;
+        self->sendTime = currentTime();
+        self->result = 0;
+        self->boostTarget = 0;
+        self->inverted = 0;
+        self->lane = lane;
+        self->tag = tag;
+        self->ref = ref;
+        if (box->numSlots == 0) {
+            lendPriority(box, self);
+        }
+        waitPush(&box->producers, self);
+        box->stats.blockedSends++;
+
+        blockOn(BLOCKED_SEND, mbox_id);
+        result = self->result;
+        if (self->inverted && result == 0) {
+            box->stats.inversions++;
+            box->stats.inversionTime += currentTime() - self->sendTime;
+        }
+    }
+
+    // a released box may already be reused, so only count successes
+    if (result == 0) {
+        box->stats.sends++;
+        countSpliced(linked, box, msg_size, tag);
+    }
+    traceEvent(TRACE_SEND, mbox_id, result == 0 ? msg_size : result);
+
+    restoreInterrupts(psr);
+    return result;
+}
+
+/**
+ * Common implementation of MboxRecv(), MboxCondRecv(), MboxRecvTag(),
+ * MboxRecvLoan() and MboxRecvRef(). tag is -1 to take the next message
+ * whatever its tag. ref is 1 to take only an MboxRef, 0 to take only a
+ * plain message and -1 for either; the wrong kind is consumed and -1
+ * returned. With a non-NULL loan the message is not copied to msg_ptr;
+ * *loan is set to the slot lent to the caller instead.
+ */
+static int MboxRecv_helper(int mbox_id, void *msg_ptr, int msg_max_size, int tag, int ref,
+                           Slot **loan, int conditional) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+    kernelStats.mboxOps++;
+
+    Mailbox *box = getMailbox(mbox_id);
+    if (box == NULL || box->released || msg_max_size < 0 || tag >= MBOX_MAX_TAGS ||
+            (tag >= 0 && (box->broadcast || box->numSlots == 0)) ||
+            (loan != NULL && box->broadcast)) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    int result;
+    Subscriber *sub = box->broadcast ? findSubscriber(box, getpid()) : NULL;
+    ShadowProc *producer;
+    box->lastReceiver = getpid();
+
+    if (box->broadcast && sub == NULL) {
+        result = -1;
+    } else if (box->broadcast && sub->cursor != NULL) {
+        result = recvBroadcast(box, sub, msg_ptr, msg_max_size);
+    } else if (!box->broadcast && (tag < 0 ? box->numQueued > 0 : hasTagged(box, tag))) {
+        // something is queued, take it and let a blocked producer in
+        if (loan != NULL) {
+            Slot *slot = detachMessage(box, tag);
+            *loan = NULL;
+            result = 0;
+            if (slot != NULL && (slot->msgSize == 0 || slot->ref)) {
+                result = slot->ref ? -1 : 0;
+                freeSlot(slot);
+            } else if (slot != NULL) {
+                result = slot->msgSize;
+                *loan = lendSlot(slot);
+            }
+        } else {
+            result = dequeueMessage(box, tag, ref, msg_ptr, msg_max_size);
+        }
+        refillFromProducer(box);
+    } else if (!box->broadcast && (producer = takeProducer(box, tag)) != NULL) {
+        // zero-slot mailbox, or a tag that only a producer blocked on the
+        // full mailbox holds: take the message straight from the producer
+        if (ref >= 0 && producer->ref != ref) {
+            result = -1;
+            if (loan != NULL) {
+                *loan = NULL;
+            }
+        } else if (loan != NULL) {
+            result = copyToLoan(producer->msgPtr, producer->msgSize, loan);
+        } else if (producer->msgSize > msg_max_size) {
+            result = -1;
+        } else {
+            if (producer->msgSize > 0) {
+                memcpy(msg_ptr, producer->msgPtr, producer->msgSize);
+            }
+            result = producer->msgSize;
+        }
+        recordLatency(box, currentTime() - producer->sendTime);
+        dropInheritance(producer);
+        producer->result = 0;
+        wakeUp(producer->pid);
+    } else if (conditional) {
+        result = -2;
+    } else {
+        ShadowProc *self = &shadowTable[getpid() % MAXPROC];
+        self->pid = getpid();
+        self->msgPtr = msg_ptr;
+        self->msgSize = msg_max_size;
+        self->result = 0;
+        self->ref = ref;
+        self->loan = loan != NULL;
+        if (tag >= 0) {
+            addWaiter(&box->tagWaiterHead[tag], &box->tagWaiterTail[tag], self);
+        } else {
+            waitPush(&box->consumers, self);
+        }
+        if (sub != NULL) {
+            sub->blocked = 1;
+        }
+        box->stats.blockedRecvs++;
+
+        blockOn(BLOCKED_RECV, mbox_id);
+        result = self->result;
+        if (loan != NULL) {
+            *loan = result > 0 ? self->loanSlot : NULL;
+        }
+        self->loan = 0;
+    }
+
+    if (result >= 0) {
+        box->stats.receives++;
+        box->stats.bytes += result;
+    }
+    traceEvent(TRACE_RECV, mbox_id, result);
+
+    restoreInterrupts(psr);
+    return result;
+}
+
+/**
+ * Common implementation of MboxForward() and MboxCondForward().
+ */
+static int MboxForward_helper(int src_id, int dst_id, int conditional) {
+    checkKernelMode(__func__);
+    int psr = disableInterrupts();
+    kernelStats.mboxOps++;
+
+    Mailbox *src = getMailbox(src_id);
+    Mailbox *dst = getMailbox(dst_id);
+    if (src == NULL || dst == NULL || src == dst || src->released || dst->released ||
+            src->broadcast || dst->broadcast) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+
+    int tag;
+    int size = peekMessage(src, &tag);
+    if (size > dst->slotSize) {
+        restoreInterrupts(psr);
+        return -1;
+    }
+    Mailbox *linked = dst;
+    if (size >= 0) {
+        dst = spliceTarget(dst, size, tag);
+        dst_id = dst - mailboxes;
+    }
+    if (conditional && (size < 0 || !canAccept(dst, tag))) {
+        restoreInterrupts(psr);
+        return -2;
+    }
+
+    char staging[MAX_MESSAGE];
+    int result;
+    if (size < 0) {
+        // nothing to move yet, wait for it like any receiver; the sender
+        // hands the message to us along with its tag, or keeps it and
+        // fails the forward if it is too big for dst
+        ShadowProc *self = &shadowTable[getpid() % MAXPROC];
+        self->forward = 1;
+        size = MboxRecv_helper(src_id, staging, dst->slotSize, -1, -1, NULL, 0);
+        self->forward = 0;
+        if (size < 0) {
+            restoreInterrupts(psr);
+            return size;
+        }
+        recordCall(RECORD_SEND, dst_id, size, 0, 0);
+        result = MboxSend_helper(dst_id, staging, size, 0, self->tag, self->ref, 0);
+
+        restoreInterrupts(psr);
+        return result == 0 ? size : result;
+    }
+
+    // take the message out of src, as a receive would
+    Slot *slot = NULL;
+    void *data = staging;
+    int lane = 0;
+    int ref = 0;
+    src->lastReceiver = getpid();
+    if (src->numQueued > 0) {
+        slot = detachMessage(src, -1);
+        if (slot != NULL) {
+            data = slotData(slot);
+            lane = slot->lane < dst->numLanes ? slot->lane : 0;
+            ref = slot->ref;
+        }
+        refillFromProducer(src);
+    } else {
+        // zero-slot src, take the message straight from a blocked producer
+        ShadowProc *producer = waitPop(&src->producers);
+        if (size > 0) {
+            memcpy(staging, producer->msgPtr, size);
+        }
+        ref = producer->ref;
+        recordLatency(src, currentTime() - producer->sendTime);
+        dropInheritance(producer);
+        producer->result = 0;
+        wakeUp(producer->pid);
+    }
+    src->stats.receives++;
+    src->stats.bytes += size;
+    traceEvent(TRACE_RECV, src_id, size);
+    recordCall(conditional ? RECORD_CONDSEND : RECORD_SEND, dst_id, size, 0, 0);
+
+    // then put it into dst, relinking the slot itself when it can be queued
+    if (slot != NULL && dst->tagWaiterHead[tag] == NULL && dst->consumers.count == 0 &&
+            dst->numQueued < dst->numSlots && dst->producers.count == 0) {
+        slot->sendTime = currentTime();
+        appendSlot(dst, slot, lane);
+        dst->stats.sends++;
+        traceEvent(TRACE_SEND, dst_id, size);
+        result = 0;
+    } else {
+        result = MboxSend_helper(dst_id, data, size, lane, tag, ref, 0);
+        if (slot != NULL) {
+            freeSlot(slot);
+        }
+    }
+    if (result == 0) {
+        countSpliced(linked, dst, size, tag);
+    }
+
+    restoreInterrupts(psr);
+    return result == 0 ? size : result;
+}
+
+/**
+ * Follows the splice links of a mailbox for a message of the given size
+ * and tag, and returns the mailbox it ends up in.
+ */
+static Mailbox *spliceTarget(Mailbox *box, int msg_size, int tag) {
+    while (box->spliceTo >= 0) {
+        Mailbox *next = &mailboxes[box->spliceTo];
+        if ((box->spliceTag >= 0 && box->spliceTag != tag) ||
+                (box->spliceMaxSize >= 0 && msg_size > box->spliceMaxSize) ||
+                msg_size > next->slotSize) {
+            break;
+        }
+        box = next;
+    }
+    return box;
+}
+
+/**
+ * Once a message sent to box has been delivered to target, counts it as
+ * spliced on each mailbox whose link it followed. A sender that blocked
+ * may find the links changed since; then nothing is counted.
+ */
+static void countSpliced(Mailbox *box, Mailbox *target, int msg_size, int tag) {
+    if (spliceTarget(box, msg_size, tag) != target) {
+        return;
+    }
+    for (; box != target; box = &mailboxes[box->spliceTo]) {
+        box->stats.spliced++;
+    }
+}
+
+/**
+ * Lends a slot just taken off a mailbox queue to the receiver. A slot that
+ * only refers to a shared payload is freed, and its reference to the
+ * payload becomes the loan. Returns the slot holding the message bytes.
+ */
+static Slot *lendSlot(Slot *slot) {
+    Slot *payload = slot->payload;
+    if (payload != NULL) {
+        slot->payload = NULL;
+        freeSlot(slot);
+        slot = payload;
+    } else {
+        slot->refCount = 1;
+    }
+    slot->loans++;
+    return slot;
+}
+
+/**
+ * Copies a message that was never queued into a fresh slot and lends it.
+ * Zero-length messages need no slot. Returns the message size, or -2 if
+ * the system-wide slot pool is exhausted.
+ */
+static int copyToLoan(void *msg_ptr, int msg_size, Slot **loan) {
+    *loan = NULL;
+    if (msg_size == 0) {
+        return 0;
+    }
+
+    Slot *slot = allocSlot();
+    if (slot == NULL) {
+        return -2;
+    }
+    slot->msgSize = msg_size;
+    memcpy(slot->msg, msg_ptr, msg_size);
+    *loan = lendSlot(slot);
+    return msg_size;
+}
+
+/**
+ * Returns the size of the message a receive from the mailbox would take
+ * next and sets *tag to its tag, or returns -1 if there is none.
+ */
+static int peekMessage(Mailbox *box, int *tag) {
+    *tag = 0;
+    if (box->numTokens > 0) {
+        return 0;
+    }
+    if (box->numQueued > 0) {
+        Slot *slot = box->slotHead[topLane(box)];
+        *tag = slot->tag;
+        return slot->msgSize;
+    }
+    if (box->producers.count > 0) {
+        ShadowProc *producer = waitAt(&box->producers, 0);
+        *tag = producer->tag;
+        return producer->msgSize;
+    }
+    return -1;
+}
+
+/**
+ * Removes and returns the receiver a message with the given tag and size
+ * should be handed to: a MboxRecvTag() caller waiting for that tag first,
+ * then the next plain receiver. Returns NULL if nobody is waiting.
+ *
+ * A MboxForward() caller whose destination is too small for the message
+ * is passed over: its forward fails with -1 and the message stays with the
+ * sender, as if it had been queued first. Those forwarders are added to
+ * the wake list if one is given, else woken at once.
+ */
+static ShadowProc *waitingConsumer(Mailbox *box, int tag, int msg_size, ShadowProc **wakeHead,
+                                   ShadowProc **wakeTail) {
+    if (box->tagWaiterHead[tag] != NULL) {
+        return popWaiter(&box->tagWaiterHead[tag], &box->tagWaiterTail[tag]);
+    }
+
+    ShadowProc *consumer;
+    while ((consumer = waitPop(&box->consumers)) != NULL && consumer->forward &&
+            msg_size > consumer->msgSize) {
+        consumer->result = -1;
+        if (wakeHead != NULL) {
+            addWaiter(wakeHead, wakeTail, consumer);
+        } else {
+            wakeUp(consumer->pid);
+        }
+    }
+    return consumer;
+}
+
+/**
+ * Returns whether a send of a message with the given tag would go through
+ * without blocking.
+ */
+static int canAccept(Mailbox *box, int tag) {
+    return box->tagWaiterHead[tag] != NULL || box->consumers.count > 0 ||
+           (box->numQueued < box->numSlots && box->producers.count == 0);
+}
+
+/**
+ * Appends a tagged message to a lane of the mailbox queue. Zero-length messages
+ * arriving at an empty single-lane box only bump the token count (and so
+ * are not timed). Returns 0 on success or -2 if the system-wide slot pool
+ * is exhausted.
+ */
+static int enqueueMessage(Mailbox *box, void *msg_ptr, int msg_size, int sendTime, int lane, int tag,
+                          int ref) {
+    if (msg_size == 0 && tag == 0 && box->numLanes == 1 && box->slotHead[0] == NULL) {
+        box->numTokens++;
+        box->numQueued++;
+        if (box->numQueued > box->stats.maxDepth) {
+            box->stats.maxDepth = box->numQueued;
+        }
+        return 0;
+    }
+
+    Slot *slot = allocSlot();
+    if (slot == NULL) {
+        return -2;
+    }
+
+    slot->msgSize = msg_size;
+    slot->sendTime = sendTime;
+    slot->tag = tag;
+    slot->ref = ref;
+    if (msg_size > 0) {
+        memcpy(slot->msg, msg_ptr, msg_size);
+    }
+    appendSlot(box, slot, lane);
+
+    return 0;
+}
+
+/**
+ * Copies a message straight into the buffer of a blocked consumer, or into
+ * a slot lent to it if it is in MboxRecvLoan(), and sets its result and the
+ * message tag and kind; the caller unblocks it.
+ */
+static void handOff(Mailbox *box, ShadowProc *consumer, void *msg_ptr, int msg_size, int tag, int ref,
+                    int sendTime) {
+    consumer->tag = tag;
+    if (consumer->ref >= 0 && consumer->ref != ref) {
+        consumer->result = -1;
+        consumer->loanSlot = NULL;
+    } else if (consumer->loan) {
+        consumer->result = copyToLoan(msg_ptr, msg_size, &consumer->loanSlot);
+    } else if (msg_size > consumer->msgSize) {
+        consumer->result = -1;
+    } else {
+        if (msg_size > 0) {
+            memcpy(consumer->msgPtr, msg_ptr, msg_size);
+        }
+        consumer->result = msg_size;
+    }
+    consumer->ref = ref;
+    recordLatency(box, currentTime() - sendTime);
+}
+
+/**
+ * Adds a send-to-receive delay (in microseconds) to the mailbox's log2
+ * latency histogram. Bucket 0 holds delays under 1us, bucket i holds
+ * delays in [2^(i-1), 2^i).
+ */
+static void recordLatency(Mailbox *box, int delay) {
+    int bucket = 0;
+    while (delay > 0 && bucket < MBOX_LATENCY_BUCKETS - 1) {
+        delay >>= 1;
+        bucket++;
+    }
+    box->stats.latency[bucket]++;
+}
+
+/**
+ * Links a filled slot at the tail of a lane of the mailbox queue and of
+ * the list for its tag, and tracks the queue's high-water mark.
+ */
+static void appendSlot(Mailbox *box, Slot *slot, int lane) {
+    slot->lane = lane;
+    slot->next = NULL;
+    slot->prev = box->slotTail[lane];
+    if (box->slotTail[lane] == NULL) {
+        box->slotHead[lane] = slot;
+        box->laneMask |= 1u << lane;
+    } else {
+        box->slotTail[lane]->next = slot;
+    }
+    box->slotTail[lane] = slot;
+
+    slot->tagNext = NULL;
+    slot->tagPrev = box->tagTail[slot->tag];
+    if (box->tagTail[slot->tag] == NULL) {
+        box->tagHead[slot->tag] = slot;
+    } else {
+        box->tagTail[slot->tag]->tagNext = slot;
+    }
+    box->tagTail[slot->tag] = slot;
+
+    box->numQueued++;
+    if (box->numQueued > box->stats.maxDepth) {
+        box->stats.maxDepth = box->numQueued;
+    }
+}
+
+/**
+ * Unlinks a queued slot from its lane and its tag list and returns it.
+ * numQueued is left to the caller.
+ */
+static Slot *unlinkSlot(Mailbox *box, Slot *slot) {
+    int lane = slot->lane;
+    if (slot->prev == NULL) {
+        box->slotHead[lane] = slot->next;
+    } else {
+        slot->prev->next = slot->next;
+    }
+    if (slot->next == NULL) {
+        box->slotTail[lane] = slot->prev;
+    } else {
+        slot->next->prev = slot->prev;
+    }
+    if (box->slotHead[lane] == NULL) {
+        box->laneMask &= ~(1u << lane);
+    }
+
+    if (slot->tagPrev == NULL) {
+        box->tagHead[slot->tag] = slot->tagNext;
+    } else {
+        slot->tagPrev->tagNext = slot->tagNext;
+    }
+    if (slot->tagNext == NULL) {
+        box->tagTail[slot->tag] = slot->tagPrev;
+    } else {
+        slot->tagNext->tagPrev = slot->tagPrev;
+    }
+    return slot;
+}
+
+/**
+ * Returns whether a message with the given tag is queued on the mailbox.
+ */
+static int hasTagged(Mailbox *box, int tag) {
+    return box->tagHead[tag] != NULL || (tag == 0 && box->numTokens > 0);
+}
+
+/**
+ * Returns the highest lane with a queued slot; laneMask must be non-zero.
+ */
+static int topLane(Mailbox *box) {
+    return 31 - __builtin_clz(box->laneMask);
+}
+
+/**
+ * Removes the oldest message of the highest non-empty lane from the
+ * mailbox queue, or with tag >= 0 the oldest message with that tag,
+ * copying it into the caller's buffer. Returns the message size, or -1 if
+ * the buffer is too small or the message is not of the kind ref asks for
+ * (the message is consumed either way).
+ */
+static int dequeueMessage(Mailbox *box, int tag, int ref, void *msg_ptr, int msg_max_size) {
+    Slot *slot = detachMessage(box, tag);
+    if (slot == NULL) {
+        return ref > 0 ? -1 : 0;
+    }
+
+    int result;
+    if ((ref >= 0 && slot->ref != ref) || slot->msgSize > msg_max_size) {
+        result = -1;
+    } else {
+        if (slot->msgSize > 0) {
+            memcpy(msg_ptr, slotData(slot), slot->msgSize);
+        }
+        result = slot->msgSize;
+    }
+
+    freeSlot(slot);
+
+    return result;
+}
+
+/**
+ * Takes the message dequeueMessage() would off the mailbox queue and
+ * returns its slot, now owned by the caller, or NULL if it was a token.
+ */
+static Slot *detachMessage(Mailbox *box, int tag) {
+    box->numQueued--;
+
+    if (box->numTokens > 0 && tag <= 0) {
+        box->numTokens--;
+        return NULL;
+    }
+
+    Slot *slot = unlinkSlot(box, tag < 0 ? box->slotHead[topLane(box)] : box->tagHead[tag]);
+    recordLatency(box, currentTime() - slot->sendTime);
+    return slot;
+}
+
+/**
+ * Appends a reference to a shared payload slot to the mailbox queue, so the
+ * message bytes are not copied again. Returns 0 on success or -2 if the
+ * system-wide slot pool is exhausted.
+ */
+static int enqueueShared(Mailbox *box, Slot *payload) {
+    Slot *slot = allocSlot();
+    if (slot == NULL) {
+        return -2;
+    }
+
+    slot->msgSize = payload->msgSize;
+    slot->sendTime = payload->sendTime;
+    slot->tag = 0;
+    slot->payload = payload;
+    payload->refCount++;
+    appendSlot(box, slot, 0);
+
+    return 0;
+}
+
+/**
+ * After a receive made room in the mailbox, moves the message of the first
+ * blocked producer into the queue and wakes it up. A message that a
+ * MboxRecvTag() caller is waiting for goes straight to it instead, which
+ * leaves the room free for the next producer.
+ */
+static void refillFromProducer(Mailbox *box) {
+    while (box->producers.count > 0 && box->numQueued < box->numSlots) {
+        ShadowProc *producer = waitPop(&box->producers);
+        ShadowProc *consumer = box->broadcast ? NULL :
+            popWaiter(&box->tagWaiterHead[producer->tag], &box->tagWaiterTail[producer->tag]);
+        if (consumer != NULL) {
+            handOff(box, consumer, producer->msgPtr, producer->msgSize, producer->tag,
+                    producer->ref, producer->sendTime);
+            wakeUp(consumer->pid);
+            producer->result = 0;
+            wakeUp(producer->pid);
+            continue;
+        }
+
+        if (box->broadcast) {
+            producer->result = broadcastMessage(box, producer->msgPtr, producer->msgSize,
+                                                producer->sendTime);
+        } else {
+            producer->result = enqueueMessage(box, producer->msgPtr, producer->msgSize,
+                                              producer->sendTime, producer->lane, producer->tag,
+                                              producer->ref);
+        }
+        wakeUp(producer->pid);
+        return;
+    }
+}
+
+/**
+ * Removes and returns the first blocked producer, in wake order, whose
+ * message has the given tag, or just the first one if tag is -1. Returns
+ * NULL if there is none. Taking a tagged message from here rather than
+ * waiting for it keeps each tag FIFO: otherwise a later sender could hand
+ * its message to the waiter ahead of the blocked one.
+ */
+static ShadowProc *takeProducer(Mailbox *box, int tag) {
+    if (tag < 0) {
+        return waitPop(&box->producers);
+    }
+
+    ShadowProc *procs[MAXPROC], *proc, *found = NULL;
+    int count = 0;
+    while ((proc = waitPop(&box->producers)) != NULL) {
+        if (found == NULL && proc->tag == tag) {
+            found = proc;
+        } else {
+            procs[count++] = proc;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        waitInsert(&box->producers, procs[i]);
+    }
+    return found;
+}
+
+/**
+ * Delivers a message to every subscriber of a broadcast mailbox. Blocked
+ * subscribers get a copy right away; for the rest the payload is stored
+ * once in a slot whose reference count is the number of readers left.
+ * Returns 0 on success or -2 if a slot was needed and none is free.
+ */
+static int broadcastMessage(Mailbox *box, void *msg_ptr, int msg_size, int sendTime) {
+    int readers = 0;
+    for (Subscriber *sub = box->subscribers; sub != NULL; sub = sub->next) {
+        if (!sub->blocked) {
+            readers++;
+        }
+    }
+
+    Slot *slot = NULL;
+    if (readers > 0) {
+        slot = allocSlot();
+        if (slot == NULL) {
+            USLOSS_Console("MboxSend_helper: Could not send, the system is out of mailbox slots.\n");
+            return -2;
+        }
+
+        slot->msgSize = msg_size;
+        slot->refCount = readers;
+        slot->sendTime = sendTime;
+        slot->tag = 0;
+        if (msg_size > 0) {
+            memcpy(slot->msg, msg_ptr, msg_size);
+        }
+        appendSlot(box, slot, 0);
+    }
+
+    for (Subscriber *sub = box->subscribers; sub != NULL; sub = sub->next) {
+        if (sub->blocked) {
+            sub->blocked = 0;
+        } else if (sub->cursor == NULL) {
+            sub->cursor = slot;
+        }
+    }
+
+    // every blocked process on a broadcast box is a caught-up subscriber
+    ShadowProc *consumers = NULL, *consumersTail = NULL, *waiter;
+    while ((waiter = waitPop(&box->consumers)) != NULL) {
+        addWaiter(&consumers, &consumersTail, waiter);
+    }
+    for (ShadowProc *proc = consumers; proc != NULL; proc = proc->next) {
+        handOff(box, proc, msg_ptr, msg_size, 0, 0, sendTime);
+    }
+    while (consumers != NULL) {
+        ShadowProc *proc = consumers;
+        consumers = proc->next;
+        wakeUp(proc->pid);
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the next unread message of a broadcast subscriber and drops its
+ * reference to it. Returns the message size, or -1 if the buffer is too
+ * small (the message is consumed either way).
+ */
+static int recvBroadcast(Mailbox *box, Subscriber *sub, void *msg_ptr, int msg_max_size) {
+    Slot *slot = sub->cursor;
+    sub->cursor = slot->next;
+    recordLatency(box, currentTime() - slot->sendTime);
+
+    int result;
+    if (slot->msgSize > msg_max_size) {
+        result = -1;
+    } else {
+        if (slot->msgSize > 0) {
+            memcpy(msg_ptr, slot->msg, slot->msgSize);
+        }
+        result = slot->msgSize;
+    }
+
+    slot->refCount--;
+    reclaimReadSlots(box);
+    refillFromProducer(box);
+
+    return result;
+}
+
+/**
+ * Frees the slots at the head of a broadcast mailbox that every subscriber
+ * has read. Subscribers read in order, so those are always a prefix.
+ */
+static void reclaimReadSlots(Mailbox *box) {
+    while (box->slotHead[0] != NULL && box->slotHead[0]->refCount == 0) {
+        freeSlot(unlinkSlot(box, box->slotHead[0]));
+        box->numQueued--;
+    }
+}
+
+/**
+ * Returns the subscription of a process to a broadcast mailbox, or NULL.
+ */
+static Subscriber *findSubscriber(Mailbox *box, int pid) {
+    for (Subscriber *sub = box->subscribers; sub != NULL; sub = sub->next) {
+        if (sub->pid == pid) {
+            return sub;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Takes a slot from the system-wide pool, or returns NULL if it is empty.
+ */
+static Slot *allocSlot(void) {
+#if PHASE2_SLOT_ALLOC == SLOT_ALLOC_ARENA
+    Slot *slot = NULL;
+    if (slotsInUse < MAXSLOTS) {
+        while (slotPool[arenaNext].allocated) {
+            arenaNext = (arenaNext + 1) % MAXSLOTS;
+        }
+        slot = &slotPool[arenaNext];
+        slot->allocated = 1;
+        arenaNext = (arenaNext + 1) % MAXSLOTS;
+    }
+#else
+    Slot *slot = freeSlots;
+    if (slot != NULL) {
+        freeSlots = slot->next;
+    }
+#endif
+    if (slot != NULL) {
+        slot->next = NULL;
+        slot->payload = NULL;
+        slot->refCount = 0;
+        slot->ref = 0;
+        slot->loans = 0;
+        slotsInUse++;
+    }
+    return slot;
+}
+
+/**
+ * Returns a slot to the system-wide pool, dropping its reference to a
+ * shared payload if it has one.
+ */
+static void freeSlot(Slot *slot) {
+    Slot *payload = slot->payload;
+
+    slot->payload = NULL;
+#if PHASE2_SLOT_ALLOC == SLOT_ALLOC_ARENA
+    slot->allocated = 0;
+#else
+    slot->next = freeSlots;
+    freeSlots = slot;
+#endif
+    slotsInUse--;
+
+    if (payload != NULL && --payload->refCount == 0) {
+        freeSlot(payload);
+    }
+}
+
+/**
+ * Returns the message bytes of a queued slot, following a shared payload.
+ */
+static char *slotData(Slot *slot) {
+    return slot->payload != NULL ? slot->payload->msg : slot->msg;
+}
+
+/**
+ * Returns the topic with the given id, or NULL if it is not in use.
+ */
+static Topic *getTopic(int topic_id) {
+    if (topic_id < 0 || topic_id >= MAXTOPICS || !topics[topic_id].inUse) {
+        return NULL;
+    }
+    return &topics[topic_id];
+}
+
+/**
+ * Removes a mailbox from a topic's subscribers. Returns 0, or -1 if it was
+ * not subscribed.
+ */
+static int dropSubscription(Topic *topic, int mbox_id) {
+    for (int i = 0; i < topic->numSubs; i++) {
+        if (topic->subMbox[i] == mbox_id) {
+            topic->numSubs--;
+            topic->subMbox[i] = topic->subMbox[topic->numSubs];
+            topic->subGen[i] = topic->subGen[topic->numSubs];
+            topic->subDrops[i] = topic->subDrops[topic->numSubs];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Unblocks every process on a detached wait list with the given result.
+ * The next pointer is read before each unblock, since a woken process may
+ * run right away and queue itself somewhere else.
+ */
+static void wakeAll(ShadowProc *list, int result) {
+    while (list != NULL) {
+        ShadowProc *proc = list;
+        list = proc->next;
+        proc->result = result;
+        wakeUp(proc->pid);
+    }
+}
+
+/**
+ * Returns the mailbox with the given id, or NULL if the id is out of range
+ * or the mailbox is not in use.
+ */
+static Mailbox *getMailbox(int mbox_id) {
+    if (mbox_id < 0 || mbox_id >= MAXMBOX || !mailboxes[mbox_id].inUse) {
+        return NULL;
+    }
+    return &mailboxes[mbox_id];
+}
+
+/**
+ * Appends a process to the tail of a wait queue.
+ */
+static void addWaiter(ShadowProc **head, ShadowProc **tail, ShadowProc *proc) {
+    proc->next = NULL;
+    if (*tail == NULL) {
+        *head = proc;
+    } else {
+        (*tail)->next = proc;
+    }
+    *tail = proc;
+}
+
+/**
+ * Removes and returns the process at the head of a wait queue, or NULL if
+ * the queue is empty.
+ */
+static ShadowProc *popWaiter(ShadowProc **head, ShadowProc **tail) {
+    ShadowProc *proc = *head;
+    if (proc != NULL) {
+        *head = proc->next;
+        if (*head == NULL) {
+            *tail = NULL;
+        }
+        proc->next = NULL;
+    }
+    return proc;
+}
+
+/**
+ * Returns nonzero if a should leave a mailbox wait queue before b. The
+ * sequence numbers are compared by difference so that wrapping is harmless.
+ */
+static int waitsBefore(ShadowProc *a, ShadowProc *b) {
+    if (a->waitKey != b->waitKey) {
+        return a->waitKey < b->waitKey;
+    }
+    return (int)(a->waitSeq - b->waitSeq) < 0;
+}
+
+/**
+ * Returns the priority a process declared with MboxSetPriority(), or
+ * LOWEST_PRIORITY if it never did.
+ */
+static int ownPriority(int pid) {
+    ShadowProc *proc = &shadowTable[pid % MAXPROC];
+    return proc->priorityPid == pid ? proc->priority : LOWEST_PRIORITY;
+}
+
+/**
+ * Returns the priority of a process, raised to any priority it inherited.
+ */
+static int priorityOf(int pid) {
+    ShadowProc *proc = &shadowTable[pid % MAXPROC];
+    int priority = ownPriority(pid);
+    if (proc->inheritedPid == pid && proc->inherited > 0 && proc->inherited < priority) {
+        priority = proc->inherited;
+    }
+    return priority;
+}
+
+/**
+ * Called when a sender is about to block on a zero-slot mailbox. Its
+ * partner will most likely be the process that last received from the
+ * mailbox; if that one has a worse priority, the sender is stuck behind it
+ * (an inversion), and with PHASE2_PRIORITY_INHERIT it lends the receiver
+ * its priority until the rendezvous.
+ */
+static void lendPriority(Mailbox *box, ShadowProc *sender) {
+    int receiver = box->lastReceiver;
+    int priority = priorityOf(sender->pid);
+
+    sender->boostTarget = 0;
+    sender->inverted = receiver > 0 && receiver != sender->pid &&
+                       priority < ownPriority(receiver);
+    if (!sender->inverted) {
+        return;
+    }
+
+#if PHASE2_PRIORITY_INHERIT
+    // other senders may already be lending to it, keep the best of them
+    ShadowProc *target = &shadowTable[receiver % MAXPROC];
+    sender->boostTarget = receiver;
+    target->inherited = lentPriority(receiver);
+    target->inheritedPid = receiver;
+    if (inheritPriority != NULL) {
+        inheritPriority(receiver, target->inherited);
+    }
+#endif
+}
+
+/**
+ * Takes back the priority a blocked sender lent, once it is being woken.
+ * The receiver keeps the best priority lent by any sender still blocked,
+ * and only goes back to its own once no lenders are left.
+ */
+static void dropInheritance(ShadowProc *sender) {
+    if (sender->boostTarget == 0) {
+        return;
+    }
+
+    int pid = sender->boostTarget;
+    ShadowProc *target = &shadowTable[pid % MAXPROC];
+    sender->boostTarget = 0;
+    int priority = lentPriority(pid);
+    if (target->inheritedPid == pid) {
+        target->inherited = priority;
+    }
+    if (inheritPriority != NULL) {
+        inheritPriority(pid, priority);
+    }
+}
+
+/**
+ * Returns the best priority lent to a process by the senders blocked on
+ * it, or 0 if none are.
+ */
+static int lentPriority(int pid) {
+    int best = 0;
+    for (int i = 0; i < MAXPROC; i++) {
+        ShadowProc *proc = &shadowTable[i];
+        if (proc->boostTarget != pid || proc->pid == pid) {
+            continue;
+        }
+        int priority = priorityOf(proc->pid);
+        if (best == 0 || priority < best) {
+            best = priority;
+        }
+    }
+    return best;
+}
+
+/**
+ * Adds a blocked process to a mailbox wait queue.
+ */
+static void waitPush(WaitQueue *queue, ShadowProc *proc) {
+    proc->waitSeq = waitSeqNext++;
+    proc->waitKey = queue->byPriority ? priorityOf(proc->pid) : 0;
+    waitInsert(queue, proc);
+}
+
+/**
+ * Puts a process into a wait queue by its waitKey and waitSeq.
+ */
+static void waitInsert(WaitQueue *queue, ShadowProc *proc) {
+#if PHASE2_WAIT_QUEUE == WAITQ_HEAP
+    int i = queue->count++;
+    while (i > 0 && waitsBefore(proc, queue->heap[(i - 1) / 2])) {
+        queue->heap[i] = queue->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->heap[i] = proc;
+#else
+    if (queue->tail == NULL || !waitsBefore(proc, queue->tail)) {
+        addWaiter(&queue->head, &queue->tail, proc);
+    } else {
+        // only on a byPriority or re-keyed queue: insert after the last
+        // waiter that goes first, which keeps arrival order within a priority
+        ShadowProc **link = &queue->head;
+        while (!waitsBefore(proc, *link)) {
+            link = &(*link)->next;
+        }
+        proc->next = *link;
+        *link = proc;
+    }
+    queue->count++;
+#endif
+}
+
+/**
+ * Switches a wait queue to the given order, re-keying the processes already
+ * in it. They keep their arrival order, so under FIFO they go back to
+ * exactly where they would have been.
+ */
+static void waitRekey(WaitQueue *queue, int byPriority) {
+    ShadowProc *procs[MAXPROC];
+    int count = 0;
+    while (queue->count > 0) {
+        procs[count++] = waitPop(queue);
+    }
+
+    queue->byPriority = byPriority;
+    for (int i = 0; i < count; i++) {
+        procs[i]->waitKey = byPriority ? priorityOf(procs[i]->pid) : 0;
+        waitInsert(queue, procs[i]);
+    }
+}
+
+/**
+ * Removes and returns the next process to wake from a mailbox wait queue,
+ * or NULL if the queue is empty.
+ */
+static ShadowProc *waitPop(WaitQueue *queue) {
+    if (queue->count == 0) {
+        return NULL;
+    }
+    queue->count--;
+#if PHASE2_WAIT_QUEUE == WAITQ_HEAP
+    ShadowProc *top = queue->heap[0];
+    ShadowProc *last = queue->heap[queue->count];
+    int i = 0;
+    while (2 * i + 1 < queue->count) {
+        int child = 2 * i + 1;
+        if (child + 1 < queue->count && waitsBefore(queue->heap[child + 1], queue->heap[child])) {
+            child++;
+        }
+        if (!waitsBefore(queue->heap[child], last)) {
+            break;
+        }
+        queue->heap[i] = queue->heap[child];
+        i = child;
+    }
+    queue->heap[i] = last;
+    return top;
+#else
+    return popWaiter(&queue->head, &queue->tail);
+#endif
+}
+
+/**
+ * Returns the index'th process in a mailbox wait queue, in storage order
+ * (wake order for a list, heap order for a heap). Only used for dumps.
+ */
+static ShadowProc *waitAt(WaitQueue *queue, int index) {
+#if PHASE2_WAIT_QUEUE == WAITQ_HEAP
+    return queue->heap[index];
+#else
+    ShadowProc *proc = queue->head;
+    while (index-- > 0) {
+        proc = proc->next;
+    }
+    return proc;
+#endif
+}
+
+/**
+ * Blocks the current process on the object with the given id, recording
+ * both ends of the blocked interval in the trace.
+ */
+static void blockOn(int reason, int id) {
+    kernelStats.blocks++;
+    traceEvent(TRACE_BLOCK, id, reason);
+    blockMe(reason);
+    traceEvent(TRACE_RESUME, id, reason);
+}
+
+/**
+ * Unblocks a process, recording it in the trace.
+ */
+static void wakeUp(int pid) {
+    traceEvent(TRACE_UNBLOCK, pid, 0);
+    unblockProc(pid);
+}
+
+/**
+ * Halts the simulation if the caller is not running in kernel mode.
+ */
+static void checkKernelMode(const char *func) {
+    if ((USLOSS_PsrGet() & USLOSS_PSR_CURRENT_MODE) == 0) {
+        USLOSS_Console("ERROR: Someone attempted to call %s while in user mode!\n", func);
+        USLOSS_Halt(1);
+    }
+}
+
+/**
+ * Disables interrupts and returns the previous PSR so it can be restored.
+ */
+static int disableInterrupts(void) {
+    int psr = USLOSS_PsrGet();
+    if (USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT) != USLOSS_DEV_OK) {
+        USLOSS_Console("ERROR: could not disable interrupts.\n");
+        USLOSS_Halt(1);
+    }
+    return psr;
+}
+
+/**
+ * Restores the interrupt state saved by disableInterrupts().
+ */
+static void restoreInterrupts(int psr) {
+    USLOSS_PsrSet(psr);
+}
+
+/**
+ * Disk interrupt handler: forwards the device status to the unit's mailbox.
+ */
+static void diskHandler(int dev, void *arg) {
+    int unit = (int)(long)arg;
+    int status;
+
+    USLOSS_DeviceInput(USLOSS_DISK_DEV, unit, &status);
+    kernelStats.interrupts++;
+    traceEvent(TRACE_INTERRUPT, USLOSS_DISK_DEV, unit);
+    MboxCondSend(DISK_BOX + unit, &status, sizeof(int));
+}
+
+/**
+ * Terminal interrupt handler: forwards the device status to the unit's
+ * mailbox.
+ */
+static void termHandler(int dev, void *arg) {
+    int unit = (int)(long)arg;
+    int status;
+
+    USLOSS_DeviceInput(USLOSS_TERM_DEV, unit, &status);
+    kernelStats.interrupts++;
+    traceEvent(TRACE_INTERRUPT, USLOSS_TERM_DEV, unit);
+    MboxCondSend(TERM_BOX + unit, &status, sizeof(int));
+}
+
+/**
+ * System call interrupt handler: dispatches through systemCallVec.
+ */
+static void syscallHandler(int dev, void *arg) {
+    USLOSS_Sysargs *args = (USLOSS_Sysargs *)arg;
+    kernelStats.syscalls++;
+    traceEvent(TRACE_SYSCALL, args->number, 0);
+
+    if (args->number < 0 || args->number >= MAXSYSCALLS) {
+        USLOSS_Console("syscallHandler(): Invalid syscall number %d\n", args->number);
+        USLOSS_Halt(1);
+    }
+
+    systemCallVec[args->number](args);
+}
+
+/**
+ * Default entry for every system call that has not been implemented.
+ */
+static void nullsys(USLOSS_Sysargs *args) {
+    USLOSS_Console("nullsys(): Program called an unimplemented syscall.  syscall no: %d   PSR: 0x%02x\n", args->number, USLOSS_PsrGet());
+    USLOSS_Halt(1);
+}
@@ -13,29 +13,323 @@
 #define MAXMBOX         2000
 #define MAXSLOTS        2500
 #define MAX_MESSAGE     150  // largest possible message in a single slot
+#define MAXSEMS         200
+#define MAXBARRIERS     50
+#define MAXEVENTS       50
+#define MAXSUBSCRIBERS  500
+#define MAXTOPICS       50
+#define MAXTOPICNAME    32
+#define MAXTOPICSUBS    50
 
+#define MBOX_LATENCY_BUCKETS 32
 
+#define TRACE_RING_SIZE 4096 // must be a power of two
+
+// trace event ops; id and size are interpreted per op
+#define TRACE_CREATE    0    // id = mailbox, size = slot size
+#define TRACE_SEND      1    // id = mailbox, size = bytes, or error code
+#define TRACE_RECV      2    // id = mailbox, size = bytes, or error code
+#define TRACE_RELEASE   3    // id = mailbox
+#define TRACE_BLOCK     4    // id = mailbox/semaphore/..., size = block reason
+#define TRACE_RESUME    5    // id = mailbox/semaphore/..., size = block reason
+#define TRACE_UNBLOCK   6    // id = pid being unblocked
+#define TRACE_DEVICE    7    // waitDevice() woke up; id = type, size = unit
+#define TRACE_INTERRUPT 8    // id = device type, size = unit
+#define TRACE_SYSCALL   9    // id = syscall number
+#define TRACE_CLOCK     10   // clock interrupt
+
+// recorded call ops, see phase2_record.c
+#define RECORD_CREATE       0
+#define RECORD_RELEASE      1
+#define RECORD_SEND         2
+#define RECORD_RECV         3
+#define RECORD_CONDSEND     4
+#define RECORD_CONDRECV     5
+#define RECORD_BROADCAST    6
+#define RECORD_SUBSCRIBE    7
+#define RECORD_UNSUBSCRIBE  8
+#define RECORD_SENDTAG      9
+#define RECORD_RECVTAG      10
+#define RECORD_CREATEPRIO   11
+#define RECORD_SENDPRIO     12
+
+// blockMe() reasons, also recorded by TRACE_BLOCK/TRACE_RESUME
+#define BLOCKED_SEND    11
+#define BLOCKED_RECV    12
+#define BLOCKED_SEM     13
+#define BLOCKED_BARRIER 14
+#define BLOCKED_EVENT   15
+
+
+// per-mailbox counters, filled in by MboxStats()
+typedef struct MboxStatsInfo {
+    int  sends;          // messages accepted by the mailbox
+    int  receives;       // messages handed to a receiver
+    int  condSendFails;  // MboxCondSend() calls that found the mailbox full
+    int  blockedSends;   // MboxSend() calls that had to block
+    int  blockedRecvs;   // MboxRecv() calls that had to block
+    long bytes;          // payload bytes received
+    int  depth;          // messages queued now
+    int  maxDepth;       // most messages ever queued at once
+    int  latency[MBOX_LATENCY_BUCKETS]; // log2 histogram of send-to-receive
+                                        // delay, bucket i < 2^i us
+    int  inversions;     // zero-slot sends that waited on a receiver with
+                         // a worse MboxSetPriority() priority
+    long inversionTime;  // total us those sends spent blocked
+    int  spliced;        // sends redirected by the mailbox's splice link
+} MboxStatsInfo;
+
+// system-wide counters, filled in by KernelStats()
+typedef struct KernelStatsInfo {
+    long mboxOps;        // MboxCreate/Release/Send/Recv calls, including Cond
+    long interrupts;     // clock, disk and terminal interrupts
+    long syscalls;
+    long blocks;         // times a process blocked in phase 2
+} KernelStatsInfo;
+
+// the message MboxSendRef() queues in place of the buffer it describes
+typedef struct MboxRef {
+    void *ptr;
+    int   len;
+} MboxRef;
+
+// one entry of the in-kernel trace ring
+typedef struct TraceRecord {
+    int           time;   // currentTime()
+    short         pid;
+    short         id;
+    short         size;
+    unsigned char op;
+} TraceRecord;
 
 extern void phase2_init(void);
 
 // returns id of mailbox, or -1 if no more mailboxes, or -1 if invalid args
 extern int MboxCreate(int slots, int slot_size);
 
-// returns 0 if successful, -1 if invalid arg
+// returns 0 if successful, -1 if invalid arg. The buffers of references
+// still queued by MboxSendRef() are not freed, drain the mailbox first
 extern int MboxRelease(int mbox_id);
 
-// returns 0 if successful, -1 if invalid args
+// returns 0 if successful, -1 if invalid args, -2 if out of system slots,
+// -3 if the mailbox was released. Zero-length messages never use a slot
+// from the system-wide pool.
 extern int MboxSend(int mbox_id, void *msg_ptr, int msg_size);
 
-// returns size of received msg if successful, -1 if invalid args
+// returns size of received msg if successful, -1 if invalid args (or the
+// message is a MboxSendRef() reference), -3 if the mailbox was released
 extern int MboxRecv(int mbox_id, void *msg_ptr, int msg_max_size);
 
-// returns 0 if successful, 1 if mailbox full, -1 if illegal args
+// returns 0 if successful, -2 if mailbox full, -1 if illegal args
 extern int MboxCondSend(int mbox_id, void *msg_ptr, int msg_size);
 
-// returns 0 if successful, 1 if no msg available, -1 if illegal args
+// returns size of received msg if successful, -2 if no msg available,
+// -1 if illegal args
 extern int MboxCondRecv(int mbox_id, void *msg_ptr, int msg_max_size);
 
+// wake order for a mailbox's blocked senders and receivers
+#define MBOX_WAKE_FIFO      0   // earliest arrival first
+#define MBOX_WAKE_PRIORITY  1   // best MboxSetPriority() first, then arrival
+
+// returns 0 if successful, -1 if invalid args
+extern int MboxSetWakePolicy(int mbox_id, int policy);
+
+// declares the caller's phase 1 priority for MBOX_WAKE_PRIORITY mailboxes;
+// returns 0 if successful, -1 if the priority is not 1 through 5
+extern int MboxSetPriority(int priority);
+
+// A sender that blocks on a zero-slot mailbox behind a receiver with a
+// worse priority is counted in MboxStats() as an inversion, and with
+// PHASE2_PRIORITY_INHERIT (see phase2_config.h) lends that receiver its
+// priority until it is woken. This is best effort:
+//   - the receiver is a guess, the mailbox's latest MboxRecv() caller,
+//     which need not be the process that will take the message
+//   - only MboxSetPriority() priorities count; a process that never
+//     declared one is taken to be at 5, the lowest
+//   - the lent priority orders MBOX_WAKE_PRIORITY wait queues the receiver
+//     joins, but only changes scheduling where phase 1 has inheritPriority()
+//     (the host build); under USLOSS the dispatcher never sees it
+
+// most priority lanes a mailbox can have; bit i of a lane bitmap is lane i
+#define MBOX_MAX_LANES      8
+
+// returns id of a mailbox whose messages are queued in nlanes priority
+// lanes; MboxRecv() takes from the highest non-empty lane, in FIFO order
+// within a lane. -1 if no more mailboxes or invalid args
+extern int MboxCreatePrio(int slots, int slot_size, int nlanes);
+
+// same as MboxSend(), but queues the message in the given lane (plain
+// MboxSend() uses lane 0). Returns -1 also if the lane is out of range
+extern int MboxSendPrio(int mbox_id, void *msg_ptr, int msg_size, int lane);
+
+// tags a message can carry; plain sends carry tag 0
+#define MBOX_MAX_TAGS       16
+
+// same as MboxSend(), but the message carries the given tag. Returns -1
+// also if the tag is not 0 through MBOX_MAX_TAGS-1
+extern int MboxSendTag(int mbox_id, void *msg_ptr, int msg_size, int tag);
+
+// returns the size of the oldest message with the given tag, blocking until
+// one arrives; -1 if invalid args (including a tag that is not 0 through
+// MBOX_MAX_TAGS-1, zero-slot and broadcast mailboxes), -3 if the mailbox
+// was released
+extern int MboxRecvTag(int mbox_id, int tag, void *msg_ptr, int msg_max_size);
+
+// receives like MboxRecv(), but instead of copying the message out sets
+// *msg_ptr to the message inside its slot (NULL for a zero-length message),
+// which the caller must hand back with MboxReturnLoan(). Returns the size
+// of the message, -1 if invalid args (including broadcast mailboxes), -2
+// if the message had to be copied into a slot and none was free, -3 if the
+// mailbox was released
+extern int MboxRecvLoan(int mbox_id, void **msg_ptr);
+
+// gives a message borrowed with MboxRecvLoan() back; returns 0 if
+// successful, -1 if msg_ptr is not an outstanding loan
+extern int MboxReturnLoan(void *msg_ptr);
+
+// sends a reference to a caller-owned buffer of len bytes (any length),
+// handing ownership of it to the receiver; the mailbox's slots must hold
+// an MboxRef, and it must not be a broadcast mailbox. Only MboxRecvRef()
+// can receive it. Returns as MboxSend()
+extern int MboxSendRef(int mbox_id, void *buf, int len);
+
+// receives a buffer reference sent with MboxSendRef() and sets *buf to it;
+// returns its length, -1 if invalid args or the message is not a
+// reference, -3 if the mailbox was released
+extern int MboxRecvRef(int mbox_id, void **buf);
+
+// moves the next message of src_id to dst_id inside the kernel, blocking
+// as MboxRecv() on src_id and then as MboxSend() on dst_id would. Returns
+// the size of the message, -1 if invalid args (including broadcast
+// mailboxes, or a message too big for dst_id), -3 if a mailbox was released
+extern int MboxForward(int src_id, int dst_id);
+
+// same as MboxForward(), but returns -2, moving nothing, if src_id is
+// empty or dst_id is full
+extern int MboxCondForward(int src_id, int dst_id);
+
+// links src_id to dst_id: from now on, messages sent to src_id with the
+// given tag (any if tag < 0) and at most max_size bytes (any if
+// max_size < 0) go to dst_id instead. Returns 0 if successful, -1 if
+// invalid args, including a broadcast src_id or a link that could loop
+extern int MboxSplice(int src_id, int dst_id, int tag, int max_size);
+
+// removes the splice link of src_id; returns 0 if successful, -1 if the
+// mailbox has no link
+extern int MboxUnsplice(int src_id);
+
+// returns id of a broadcast mailbox, where each message is delivered to
+// every subscriber; -1 if no more mailboxes or invalid args (slots < 1)
+extern int MboxCreateBroadcast(int slots, int slot_size);
+
+// returns 0 if successful, -1 if not a broadcast mailbox, already
+// subscribed, or no more subscriber entries
+extern int MboxSubscribe(int mbox_id);
+
+// returns 0 if successful, -1 if not subscribed
+extern int MboxUnsubscribe(int mbox_id);
+
+// returns 0 and fills in *stats if successful, -1 if invalid args
+extern int MboxStats(int mbox_id, MboxStatsInfo *stats);
+
+// returns the upper bound in us of the latency bucket holding the given
+// percentile of stats->latency, or -1 if there are no samples
+extern int MboxLatencyPercentile(MboxStatsInfo *stats, int percent);
+
+// prints p50/p99 send-to-receive latency of every mailbox with samples
+extern void MboxLatencyReport(void);
+
+// prints every mailbox in use, its queued messages, blocked processes,
+// and the system-wide slot usage
+extern void MboxDump(void);
+
+// copies the system-wide counters into *stats
+extern void KernelStats(KernelStatsInfo *stats);
+
+// returns id of a new named topic, or -1 if the name is taken or invalid
+extern int TopicCreate(char *name);
+
+// returns id of the topic with that name, or -1 if none
+extern int TopicLookup(char *name);
+
+// queues every later publish on mbox_id, until it is unsubscribed or
+// released; returns 0 if successful, -1 if invalid args or already subscribed
+extern int TopicSubscribe(int topic_id, int mbox_id);
+
+// returns 0 if successful, -1 if not subscribed
+extern int TopicUnsubscribe(int topic_id, int mbox_id);
+
+// never blocks; returns the number of subscribers the message was queued
+// for (full mailboxes count as drops), or -1 if invalid args
+extern int TopicPublish(int topic_id, void *msg_ptr, int msg_size);
+
+// returns number of publishes dropped for mbox_id, -1 if not subscribed
+extern int TopicDrops(int topic_id, int mbox_id);
+
+// returns id of semaphore, or -1 if no more semaphores or value < 0
+extern int SemCreate(int value);
+
+// returns 0 if successful, -1 if invalid arg
+extern int SemFree(int sem_id);
+
+// returns 0 if successful, -1 if invalid arg, -3 if the semaphore was freed
+extern int SemP(int sem_id);
+
+// returns 0 if successful, -1 if invalid arg
+extern int SemV(int sem_id);
+
+// returns id of barrier for count processes, or -1 if none left or count < 1
+extern int BarrierCreate(int count);
+
+// returns 0 if successful, -1 if invalid arg
+extern int BarrierFree(int barrier_id);
+
+// returns 0 once count processes have arrived, -1 if invalid arg,
+// -3 if the barrier was freed
+extern int BarrierWait(int barrier_id);
+
+// returns id of event group, or -1 if no more event groups
+extern int EventCreate(void);
+
+// returns 0 if successful, -1 if invalid arg
+extern int EventFree(int event_id);
+
+// sets bits and wakes all matching waiters; returns 0, or -1 if invalid arg
+extern int EventSet(int event_id, int bits);
+
+// returns 0 if successful, -1 if invalid arg
+extern int EventClear(int event_id, int bits);
+
+// returns the set bits of mask once any is set, -1 if invalid args,
+// -3 if the event group was freed
+extern int EventWait(int event_id, int mask);
+
+// copies up to max of the newest trace records into buf, oldest first;
+// returns the number copied
+extern int TraceRead(TraceRecord *buf, int max);
+
+// prints the trace ring, oldest first
+extern void TraceDump(void);
+
+// writes the trace ring to a host file in Chrome trace event JSON format
+// (chrome://tracing, ui.perfetto.dev); returns 0, or -1 if the file could
+// not be written
+extern int TraceExportChrome(char *path);
+
+// kernel-internal: tracing starts once processes exist
+extern void traceStart(void);
+extern void traceEvent(int op, int id, int size);
+
+// starts logging every core mailbox call to a host file, for replay with
+// host/replay; returns 0, or -1 if the file could not be opened
+extern int RecordStart(char *path);
+
+// stops recording and closes the file
+extern void RecordStop(void);
+
+// kernel-internal: appends one call to the recording
+extern void recordCall(int op, int id, int size, int arg, int arg2);
+
 // type = interrupt device type, unit = # of device (when more than one),
 // status = where interrupt handler puts device's status register.
 extern void     waitDevice(int type, int unit, int *status);
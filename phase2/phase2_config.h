@@ -0,0 +1,40 @@
+/*
+ * Compile-time choices for the mailbox engine's internals. Each one is
+ * resolved by the preprocessor, so the engine pays nothing for the
+ * alternatives it was not built with. Override on the command line, e.g.
+ *
+ *     make EXTRA_CFLAGS=-DPHASE2_WAIT_QUEUE=WAITQ_HEAP
+ *
+ * or build every combination with 'make configs'.
+ */
+
+#ifndef _PHASE2_CONFIG_H
+#define _PHASE2_CONFIG_H
+
+// how message slots are taken from the system-wide pool of MAXSLOTS
+#define SLOT_ALLOC_FREELIST 1   // LIFO free list: reuses the slot freed last
+#define SLOT_ALLOC_ARENA    2   // next-fit sweep: hands slots out in address
+                                // order, so a FIFO stream walks memory linearly
+
+// how the processes blocked on a mailbox are queued
+#define WAITQ_LIST          1   // linked list, O(1) append and pop, but an
+                                // MBOX_WAKE_PRIORITY push is a sorted insert
+#define WAITQ_HEAP          2   // binary heap, O(log n) push and pop
+
+// whether a sender blocked on a zero-slot mailbox lends its priority to
+// the lower-priority receiver it is waiting for (1) or not (0); the
+// inversions are counted in MboxStats() either way. See phase2.h, next to
+// MboxSetPriority(), for what the lending can and can't do
+#ifndef PHASE2_PRIORITY_INHERIT
+#define PHASE2_PRIORITY_INHERIT 1
+#endif
+
+#ifndef PHASE2_SLOT_ALLOC
+#define PHASE2_SLOT_ALLOC   SLOT_ALLOC_FREELIST
+#endif
+
+#ifndef PHASE2_WAIT_QUEUE
+#define PHASE2_WAIT_QUEUE   WAITQ_HEAP
+#endif
+
+#endif
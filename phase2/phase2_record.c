@@ -0,0 +1,122 @@
+/**
+ * AUTHORS:    Kevin Nisterenko and Rey Sanayei
+ * COURSE:     CSC 452, Spring 2023
+ * INSTRUCTOR: Russell Lewis
+ * ASSIGNMENT: Phase2
+ *
+ * Operation recorder. While recording, every call to the core mailbox API
+ * is appended to a host file as one text line, in the order the calls were
+ * made, so that host/replay can later drive the same sequence against a
+ * different mailbox engine. The format is
+ *
+ *     TIME PID OP MBOX SIZE [ARG [ARG2]]
+ *
+ * where OP is create, createprio (MboxCreatePrio()), broadcast
+ * (MboxCreateBroadcast()), release, send, recv, condsend, condrecv,
+ * subscribe, unsubscribe, sendtag (MboxSendTag()), recvtag (MboxRecvTag())
+ * or sendprio (MboxSendPrio()); SIZE is the message size (sends), the
+ * buffer size (receives), the slot size (creates) or 0. ARG is the slot
+ * count for creates, the tag for sendtag and recvtag and the lane for
+ * sendprio, and ARG2 the lane count for createprio; ops without them leave
+ * them out. Creates are logged once
+ * they succeed, since MBOX is the id they returned; everything else is
+ * logged on entry, before it can block.
+ */
+
+// ----- Includes
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+#include <stdio.h>
+
+// ----- Function Prototypes
+int RecordStart(char *path);
+void RecordStop(void);
+void recordCall(int op, int id, int size, int arg, int arg2);
+
+// ----- Global data structures/vars
+static FILE *recordFile;
+
+static const char *recordOpNames[] = {
+    [RECORD_CREATE]      = "create",
+    [RECORD_RELEASE]     = "release",
+    [RECORD_SEND]        = "send",
+    [RECORD_RECV]        = "recv",
+    [RECORD_CONDSEND]    = "condsend",
+    [RECORD_CONDRECV]    = "condrecv",
+    [RECORD_BROADCAST]   = "broadcast",
+    [RECORD_SUBSCRIBE]   = "subscribe",
+    [RECORD_UNSUBSCRIBE] = "unsubscribe",
+    [RECORD_SENDTAG]     = "sendtag",
+    [RECORD_RECVTAG]     = "recvtag",
+    [RECORD_CREATEPRIO]  = "createprio",
+    [RECORD_SENDPRIO]    = "sendprio",
+};
+
+// how many of ARG and ARG2 each op writes
+static const int recordOpArgs[] = {
+    [RECORD_CREATE]      = 1,
+    [RECORD_BROADCAST]   = 1,
+    [RECORD_SENDTAG]     = 1,
+    [RECORD_RECVTAG]     = 1,
+    [RECORD_CREATEPRIO]  = 2,
+    [RECORD_SENDPRIO]    = 1,
+};
+
+/**
+ * Starts recording to the given host file, replacing its contents and
+ * ending any recording already in progress. Returns 0, or -1 if the file
+ * could not be opened.
+ */
+int RecordStart(char *path) {
+    RecordStop();
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+
+    int psr = USLOSS_PsrGet();
+    USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
+    recordFile = out;
+    USLOSS_PsrSet(psr);
+    return 0;
+}
+
+/**
+ * Stops recording and closes the file. Does nothing if not recording.
+ */
+void RecordStop(void) {
+    int psr = USLOSS_PsrGet();
+    USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
+
+    if (recordFile != NULL) {
+        fclose(recordFile);
+        recordFile = NULL;
+    }
+
+    USLOSS_PsrSet(psr);
+}
+
+/**
+ * Appends one call to the recording, if one is in progress.
+ */
+void recordCall(int op, int id, int size, int arg, int arg2) {
+    if (recordFile == NULL) {
+        return;
+    }
+
+    int psr = USLOSS_PsrGet();
+    USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
+
+    fprintf(recordFile, "%d %d %s %d %d", currentTime(), getpid(), recordOpNames[op], id, size);
+    if (recordOpArgs[op] >= 1) {
+        fprintf(recordFile, " %d", arg);
+    }
+    if (recordOpArgs[op] >= 2) {
+        fprintf(recordFile, " %d", arg2);
+    }
+    fprintf(recordFile, "\n");
+
+    USLOSS_PsrSet(psr);
+}
@@ -0,0 +1,178 @@
+/**
+ * AUTHORS:    Kevin Nisterenko and Rey Sanayei
+ * COURSE:     CSC 452, Spring 2023
+ * INSTRUCTOR: Russell Lewis
+ * ASSIGNMENT: Phase2
+ *
+ * In-kernel event trace. Mailbox operations, blocking, device wakeups and
+ * system calls are recorded as fixed-size binary records in a ring buffer
+ * that always holds the most recent TRACE_RING_SIZE events, so a slowdown
+ * can be reconstructed after the fact.
+ */
+
+// ----- Includes
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+#include <stdio.h>
+#include <string.h>
+
+// ----- Function Prototypes
+void traceStart(void);
+void traceEvent(int op, int id, int size);
+int TraceRead(TraceRecord *buf, int max);
+void TraceDump(void);
+int TraceExportChrome(char *path);
+
+// ----- Global data structures/vars
+static TraceRecord traceRing[TRACE_RING_SIZE];
+static unsigned    traceNext;       // total events recorded; next index
+static int         traceEnabled;
+
+static const char *traceOpNames[] = {
+    "create", "send", "recv", "release", "block", "resume", "unblock",
+    "device", "interrupt", "syscall", "clock",
+};
+
+static const char *blockReasonNames[] = {
+    [BLOCKED_SEND]    = "MboxSend",
+    [BLOCKED_RECV]    = "MboxRecv",
+    [BLOCKED_SEM]     = "SemP",
+    [BLOCKED_BARRIER] = "BarrierWait",
+    [BLOCKED_EVENT]   = "EventWait",
+};
+
+/**
+ * Turns tracing on. Called once processes exist, since every record
+ * carries the pid of the current process.
+ */
+void traceStart(void) {
+    traceNext = 0;
+    traceEnabled = 1;
+}
+
+/**
+ * Appends an event to the ring, overwriting the oldest one when full. The
+ * caller has interrupts disabled.
+ */
+void traceEvent(int op, int id, int size) {
+    if (!traceEnabled) {
+        return;
+    }
+
+    TraceRecord *rec = &traceRing[traceNext & (TRACE_RING_SIZE - 1)];
+    rec->time = currentTime();
+    rec->pid  = getpid();
+    rec->op   = op;
+    rec->id   = id;
+    rec->size = size;
+    traceNext++;
+}
+
+/**
+ * Copies up to max of the most recent records into buf, oldest first.
+ * Returns the number of records copied.
+ */
+int TraceRead(TraceRecord *buf, int max) {
+    int psr = USLOSS_PsrGet();
+    USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
+
+    int count = traceNext < TRACE_RING_SIZE ? (int)traceNext : TRACE_RING_SIZE;
+    if (count > max) {
+        count = max;
+    }
+
+    unsigned start = traceNext - count;
+    for (int i = 0; i < count; i++) {
+        buf[i] = traceRing[(start + i) & (TRACE_RING_SIZE - 1)];
+    }
+
+    USLOSS_PsrSet(psr);
+    return count;
+}
+
+/**
+ * Prints the contents of the ring, oldest first.
+ */
+void TraceDump(void) {
+    int psr = USLOSS_PsrGet();
+    USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
+
+    unsigned count = traceNext < TRACE_RING_SIZE ? traceNext : TRACE_RING_SIZE;
+    USLOSS_Console("trace: %u events recorded, showing last %u\n", traceNext, count);
+    USLOSS_Console("      TIME   PID  OP          ID    SIZE\n");
+
+    for (unsigned i = traceNext - count; i != traceNext; i++) {
+        TraceRecord *rec = &traceRing[i & (TRACE_RING_SIZE - 1)];
+        USLOSS_Console("%10d  %4d  %-9s  %4d  %6d\n", rec->time, rec->pid,
+                       traceOpNames[rec->op], rec->id, rec->size);
+    }
+
+    USLOSS_PsrSet(psr);
+}
+
+/**
+ * Writes the trace ring to a host file as Chrome trace event JSON. Each
+ * simulated process is a thread: blocked intervals become duration events
+ * named after the call that blocked, mailbox operations are instant
+ * events on the process, and interrupts and clock ticks are global
+ * instant events. Returns 0, or -1 if the file could not be written.
+ */
+int TraceExportChrome(char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+
+    int psr = USLOSS_PsrGet();
+    USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
+
+    // a resume whose block fell off the ring would close nothing
+    char blocked[MAXPROC];
+    memset(blocked, 0, sizeof(blocked));
+
+    unsigned count = traceNext < TRACE_RING_SIZE ? traceNext : TRACE_RING_SIZE;
+    const char *sep = "";
+
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (unsigned i = traceNext - count; i != traceNext; i++) {
+        TraceRecord *rec = &traceRing[i & (TRACE_RING_SIZE - 1)];
+        int slot = rec->pid % MAXPROC;
+
+        switch (rec->op) {
+        case TRACE_BLOCK:
+            fprintf(out, "%s{\"name\": \"%s %d\", \"cat\": \"blocked\", \"ph\": \"B\", "
+                    "\"ts\": %d, \"pid\": 1, \"tid\": %d}",
+                    sep, blockReasonNames[rec->size], rec->id, rec->time, rec->pid);
+            blocked[slot] = 1;
+            break;
+        case TRACE_RESUME:
+            if (!blocked[slot]) {
+                continue;
+            }
+            fprintf(out, "%s{\"ph\": \"E\", \"ts\": %d, \"pid\": 1, \"tid\": %d}",
+                    sep, rec->time, rec->pid);
+            blocked[slot] = 0;
+            break;
+        case TRACE_INTERRUPT:
+        case TRACE_CLOCK:
+            fprintf(out, "%s{\"name\": \"%s\", \"cat\": \"device\", \"ph\": \"i\", \"s\": \"g\", "
+                    "\"ts\": %d, \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"type\": %d, \"unit\": %d}}",
+                    sep, traceOpNames[rec->op], rec->time, rec->pid, rec->id, rec->size);
+            break;
+        default:
+            fprintf(out, "%s{\"name\": \"%s\", \"cat\": \"mbox\", \"ph\": \"i\", \"s\": \"t\", "
+                    "\"ts\": %d, \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"id\": %d, \"size\": %d}}",
+                    sep, traceOpNames[rec->op], rec->time, rec->pid, rec->id, rec->size);
+            break;
+        }
+        sep = ",\n";
+    }
+    fprintf(out, "\n]}\n");
+
+    USLOSS_PsrSet(psr);
+
+    return fclose(out) == 0 ? 0 : -1;
+}
@@ -41,6 +41,9 @@ int testcase_main()
     int pid_fork, pid_join;
     int status;
 
+#ifdef PHASE2_RECORD
+    RecordStart("phase2_record.txt");
+#endif
     pid_fork = fork1("start2", start2, "start2", 4*USLOSS_MIN_STACK, 1);
     pid_join = join(&status);
 
@@ -115,6 +118,29 @@ void phase5_start_service_processes()
 
 void finish(int argc, char **argv)
 {
+    /* off by default, since they would change every testcase's output */
+#ifdef PHASE2_RECORD
+    RecordStop();
+#endif
+#ifdef PHASE2_LATENCY_REPORT
+    MboxLatencyReport();
+#endif
+#ifdef PHASE2_TRACE_DUMP
+    TraceDump();
+#endif
+#ifdef PHASE2_TRACE_JSON
+    TraceExportChrome("phase2_trace.json");
+#endif
+#ifdef PHASE2_PERF_REPORT
+    KernelStatsInfo stats;
+    KernelStats(&stats);
+
+    /* phase1 calls mmu_flush() on every context switch */
+    USLOSS_Console("%s(): perf: time %d us, context switches %d, mailbox ops %ld, interrupts %ld, syscalls %ld, blocks %ld\n",
+                   __func__, currentTime(), mmu_flush_count, stats.mboxOps,
+                   stats.interrupts, stats.syscalls, stats.blocks);
+#endif
+
     USLOSS_Console("%s(): The simulation is now terminating.\n", __func__);
 }
 
@@ -22,12 +22,13 @@ int start2(char *arg)
 
     /* 50 mailboxes, capacity 55 each.  Each is individually legal, but if they
      * all backlog at the same time, then that will consume the system capacity
-     * of MAXSLOTS=2500 mail messages.
+     * of MAXSLOTS=2500 mail messages.  The messages carry one byte, because
+     * zero-length messages are only counted and never take a slot.
      */
 
     for (boxNum = 0; boxNum < 50; boxNum++)
     {
-        mboxids[boxNum] = MboxCreate(55, 0);
+        mboxids[boxNum] = MboxCreate(55, 1);
         if (mboxids[boxNum] < 0)
             USLOSS_Console("start2(): MailBoxCreate returned id less than zero, id = %d\n", mboxids[boxNum]);
     }
@@ -36,7 +37,7 @@ int start2(char *arg)
     {
         for (slotNum = 0; slotNum < 55; slotNum++)
         {
-            result = MboxSend(mboxids[boxNum], NULL,0);
+            result = MboxSend(mboxids[boxNum], "x",1);
             if (result == -2)
             {
                 USLOSS_Console("No slots available: mailbox %d and slot %d\n", boxNum, slotNum);
@@ -26,7 +26,7 @@ int start2(char *arg)
 
     for (boxNum = 0; boxNum < 50; boxNum++)
     {
-        mboxids[boxNum] = MboxCreate(55, 0);
+        mboxids[boxNum] = MboxCreate(55, 1);
         if (mboxids[boxNum] < 0)
             USLOSS_Console("start2(): MailBoxCreate returned id less than zero, id = %d\n", mboxids[boxNum]);
     }
@@ -35,7 +35,7 @@ int start2(char *arg)
     {
         for (slotNum = 0; slotNum < 55; slotNum++)
         {
-            result = MboxCondSend(mboxids[boxNum], NULL,0);
+            result = MboxCondSend(mboxids[boxNum], "x",1);
             if (result == -2)
             {
                 USLOSS_Console("No slots available: mailbox %d and slot %d\n", boxNum, slotNum);
@@ -0,0 +1,77 @@
+
+/* SemFree() with one high priority and two low priority processes blocked in
+ * SemP().  The high priority process runs as soon as it is woken, and creates
+ * a new semaphore, which reuses the id that was just freed.  The two low
+ * priority processes must still be woken with -3.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Hi(char *);
+int Lo(char *);
+int Freer(char *);
+
+int sem_id;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    sem_id = SemCreate(0);
+    USLOSS_Console("start2(): SemCreate returned id = %d\n", sem_id);
+
+    fork1("Hi",    Hi,    "Hi",  2 * USLOSS_MIN_STACK, 1);
+    fork1("LoA",   Lo,    "LoA", 2 * USLOSS_MIN_STACK, 3);
+    fork1("LoB",   Lo,    "LoB", 2 * USLOSS_MIN_STACK, 3);
+    fork1("Freer", Freer, NULL,  2 * USLOSS_MIN_STACK, 4);
+
+    for (i = 0; i < 4; i++) {
+        join(&kid_status);
+        USLOSS_Console("start2(): joined with a kid, status = %d\n", kid_status);
+    }
+
+    quit(0);
+}
+
+int Hi(char *arg)
+{
+    int result, new_id;
+
+    USLOSS_Console("%s(): blocking in SemP\n", arg);
+    result = SemP(sem_id);
+    USLOSS_Console("%s(): SemP returned %d\n", arg, result);
+
+    new_id = SemCreate(1);
+    USLOSS_Console("%s(): SemCreate returned the freed id: %s\n", arg,
+                   new_id == sem_id ? "yes" : "no");
+
+    quit(1);
+}
+
+int Lo(char *arg)
+{
+    int result;
+
+    USLOSS_Console("%s(): blocking in SemP\n", arg);
+    result = SemP(sem_id);
+    USLOSS_Console("%s(): SemP returned %d\n", arg, result);
+
+    quit(2);
+}
+
+int Freer(char *arg)
+{
+    int result;
+
+    USLOSS_Console("Freer(): freeing the semaphore\n");
+    result = SemFree(sem_id);
+    USLOSS_Console("Freer(): SemFree returned %d\n", result);
+
+    quit(3);
+}
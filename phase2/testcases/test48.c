@@ -0,0 +1,66 @@
+
+/* TopicPublish() to a mailbox whose only receiver is blocked in
+ * MboxRecvTag() for tag 0.  Published messages carry tag 0, so the message
+ * must be handed straight to that receiver, not left in the queue.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Receiver(char *);
+int Publisher(char *);
+
+int mbox_id;
+int topic_id;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    mbox_id = MboxCreate(2, 50);
+    topic_id = TopicCreate("news");
+    USLOSS_Console("start2(): TopicSubscribe returned %d\n",
+                   TopicSubscribe(topic_id, mbox_id));
+
+    fork1("Receiver",  Receiver,  NULL, 2 * USLOSS_MIN_STACK, 2);
+    fork1("Publisher", Publisher, NULL, 2 * USLOSS_MIN_STACK, 3);
+
+    for (i = 0; i < 2; i++) {
+        join(&kid_status);
+        USLOSS_Console("start2(): joined with a kid, status = %d\n", kid_status);
+    }
+
+    quit(0);
+}
+
+int Receiver(char *arg)
+{
+    char buf[50];
+    int result;
+
+    USLOSS_Console("Receiver(): blocking in MboxRecvTag for tag 0\n");
+    result = MboxRecvTag(mbox_id, 0, buf, sizeof(buf));
+    USLOSS_Console("Receiver(): MboxRecvTag returned %d, message '%s'\n", result, buf);
+
+    quit(1);
+}
+
+int Publisher(char *arg)
+{
+    char buf[50];
+    int result;
+
+    USLOSS_Console("Publisher(): publishing\n");
+    result = TopicPublish(topic_id, "headline", 9);
+    USLOSS_Console("Publisher(): TopicPublish returned %d\n", result);
+
+    result = MboxCondRecv(mbox_id, buf, sizeof(buf));
+    USLOSS_Console("Publisher(): MboxCondRecv on the mailbox returned %d\n", result);
+
+    quit(2);
+}
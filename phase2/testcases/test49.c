@@ -0,0 +1,52 @@
+
+/* Buffer references sent with MboxSendRef().  A plain MboxRecv() rejects a
+ * reference and MboxRecvRef() rejects a plain message, even when the plain
+ * message is the size of an MboxRef.  A reference moved by MboxForward()
+ * is still a reference, and reference sends to broadcast mailboxes fail.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+char data[100] = "a buffer passed by reference";
+
+
+
+int start2(char *arg)
+{
+    int box_a, box_b, bcast, result;
+    char buf[sizeof(MboxRef)];
+    MboxRef fake = { data, 5 };
+    void *ptr;
+
+    USLOSS_Console("start2(): started\n");
+    box_a = MboxCreate(4, sizeof(MboxRef));
+    box_b = MboxCreate(4, sizeof(MboxRef));
+    bcast = MboxCreateBroadcast(4, sizeof(MboxRef));
+
+    result = MboxSendRef(box_a, data, sizeof(data));
+    USLOSS_Console("start2(): MboxSendRef returned %d\n", result);
+    result = MboxRecv(box_a, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxRecv of a reference returned %d\n", result);
+
+    result = MboxSend(box_a, &fake, sizeof(fake));
+    USLOSS_Console("start2(): MboxSend of an MboxRef-sized message returned %d\n", result);
+    result = MboxRecvRef(box_a, &ptr);
+    USLOSS_Console("start2(): MboxRecvRef of a plain message returned %d\n", result);
+
+    result = MboxSendRef(box_a, data, sizeof(data));
+    USLOSS_Console("start2(): MboxSendRef returned %d\n", result);
+    result = MboxForward(box_a, box_b);
+    USLOSS_Console("start2(): MboxForward moved the MboxRef: %s\n",
+                   result == sizeof(MboxRef) ? "yes" : "no");
+    result = MboxRecvRef(box_b, &ptr);
+    USLOSS_Console("start2(): MboxRecvRef after the forward returned %d, '%s'\n",
+                   result, (char *) ptr);
+
+    result = MboxSendRef(bcast, data, sizeof(data));
+    USLOSS_Console("start2(): MboxSendRef to a broadcast mailbox returned %d\n", result);
+
+    quit(0);
+}
@@ -0,0 +1,65 @@
+
+/* MboxForward() blocked on an empty source mailbox.  A message that fits
+ * in the destination's slots is forwarded; one that is too big fails the
+ * forward with -1 and stays in the source mailbox instead of being lost.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Forwarder(char *);
+int Sender(char *);
+
+int src_box, dst_box;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status, result;
+    char buf[50];
+
+    USLOSS_Console("start2(): started\n");
+    src_box = MboxCreate(2, 50);
+    dst_box = MboxCreate(2, 10);
+
+    for (i = 0; i < 2; i++) {
+        fork1("Forwarder", Forwarder, NULL, 2 * USLOSS_MIN_STACK, 2);
+        fork1("Sender", Sender, i == 0 ? "small" : "a message too big for dst",
+              2 * USLOSS_MIN_STACK, 3);
+        join(&kid_status);
+        join(&kid_status);
+    }
+
+    result = MboxCondRecv(dst_box, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxCondRecv on dst returned %d, '%s'\n", result, buf);
+    result = MboxCondRecv(src_box, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxCondRecv on src returned %d, '%s'\n", result, buf);
+
+    quit(0);
+}
+
+int Forwarder(char *arg)
+{
+    int result;
+
+    USLOSS_Console("Forwarder(): blocking in MboxForward\n");
+    result = MboxForward(src_box, dst_box);
+    USLOSS_Console("Forwarder(): MboxForward returned %d\n", result);
+
+    quit(1);
+}
+
+int Sender(char *arg)
+{
+    int result;
+
+    USLOSS_Console("Sender(): sending '%s'\n", arg);
+    result = MboxSend(src_box, arg, strlen(arg) + 1);
+    USLOSS_Console("Sender(): MboxSend returned %d\n", result);
+
+    quit(2);
+}
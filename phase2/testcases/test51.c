@@ -0,0 +1,84 @@
+
+/* Barriers.  Three workers meet at the same barrier twice, so the barrier
+ * is reused for a second phase.  Then two processes wait on a barrier that
+ * is freed before a third one arrives; both get -3, and the freed id is
+ * rejected afterwards.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Worker(char *);
+int Waiter(char *);
+int Freer(char *);
+
+int barrier_id;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status, result;
+
+    USLOSS_Console("start2(): started\n");
+    result = BarrierCreate(0);
+    USLOSS_Console("start2(): BarrierCreate(0) returned %d\n", result);
+
+    barrier_id = BarrierCreate(3);
+    fork1("WorkerA", Worker, "WorkerA", 2 * USLOSS_MIN_STACK, 3);
+    fork1("WorkerB", Worker, "WorkerB", 2 * USLOSS_MIN_STACK, 3);
+    fork1("WorkerC", Worker, "WorkerC", 2 * USLOSS_MIN_STACK, 3);
+    for (i = 0; i < 3; i++) {
+        join(&kid_status);
+    }
+    USLOSS_Console("start2(): all workers done\n");
+
+    barrier_id = BarrierCreate(3);
+    fork1("WaiterA", Waiter, "WaiterA", 2 * USLOSS_MIN_STACK, 3);
+    fork1("WaiterB", Waiter, "WaiterB", 2 * USLOSS_MIN_STACK, 3);
+    fork1("Freer",   Freer,  NULL,      2 * USLOSS_MIN_STACK, 4);
+    for (i = 0; i < 3; i++) {
+        join(&kid_status);
+    }
+
+    result = BarrierWait(barrier_id);
+    USLOSS_Console("start2(): BarrierWait on the freed barrier returned %d\n", result);
+
+    quit(0);
+}
+
+int Worker(char *arg)
+{
+    int phase, result;
+
+    for (phase = 1; phase <= 2; phase++) {
+        USLOSS_Console("%s(): arriving for phase %d\n", arg, phase);
+        result = BarrierWait(barrier_id);
+        USLOSS_Console("%s(): past phase %d, BarrierWait returned %d\n", arg, phase, result);
+    }
+
+    quit(1);
+}
+
+int Waiter(char *arg)
+{
+    int result;
+
+    USLOSS_Console("%s(): waiting at the barrier\n", arg);
+    result = BarrierWait(barrier_id);
+    USLOSS_Console("%s(): BarrierWait returned %d\n", arg, result);
+
+    quit(2);
+}
+
+int Freer(char *arg)
+{
+    int result;
+
+    result = BarrierFree(barrier_id);
+    USLOSS_Console("Freer(): BarrierFree returned %d\n", result);
+
+    quit(3);
+}
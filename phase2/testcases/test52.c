@@ -0,0 +1,78 @@
+
+/* Event groups.  Three waiters block on different masks of one group, and
+ * each is woken only by a flag in its mask, with the matching flags as its
+ * result.  Cleared flags no longer satisfy a wait, a wait on flags that are
+ * already set returns at once, and EventFree() wakes the last waiter with
+ * -3.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Waiter(char *);
+int Setter(char *);
+
+int event_id;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status, result;
+
+    USLOSS_Console("start2(): started\n");
+    event_id = EventCreate();
+    result = EventWait(event_id, 0);
+    USLOSS_Console("start2(): EventWait with an empty mask returned %d\n", result);
+
+    fork1("WaiterA", Waiter, "1", 2 * USLOSS_MIN_STACK, 2);
+    fork1("WaiterB", Waiter, "6", 2 * USLOSS_MIN_STACK, 2);
+    fork1("WaiterC", Waiter, "8", 2 * USLOSS_MIN_STACK, 2);
+    fork1("Setter",  Setter, NULL, 2 * USLOSS_MIN_STACK, 3);
+    for (i = 0; i < 4; i++) {
+        join(&kid_status);
+    }
+
+    result = EventSet(event_id, 1);
+    USLOSS_Console("start2(): EventSet on the freed group returned %d\n", result);
+
+    quit(0);
+}
+
+int Waiter(char *arg)
+{
+    int mask = arg[0] - '0';
+    int result;
+
+    USLOSS_Console("Waiter(): waiting for mask 0x%x\n", mask);
+    result = EventWait(event_id, mask);
+    USLOSS_Console("Waiter(): mask 0x%x woken, EventWait returned %d\n", mask, result);
+
+    quit(mask);
+}
+
+int Setter(char *arg)
+{
+    int result;
+
+    USLOSS_Console("Setter(): setting 0x4\n");
+    EventSet(event_id, 0x4);
+    USLOSS_Console("Setter(): setting 0x1 and 0x2\n");
+    EventSet(event_id, 0x3);
+
+    result = EventWait(event_id, 0x6);
+    USLOSS_Console("Setter(): EventWait for 0x6 with 0x7 set returned %d\n", result);
+
+    USLOSS_Console("Setter(): clearing 0x7, then setting 0x10\n");
+    EventClear(event_id, 0x7);
+    EventSet(event_id, 0x10);
+    result = EventWait(event_id, 0x17);
+    USLOSS_Console("Setter(): EventWait for 0x17 returned %d\n", result);
+
+    result = EventFree(event_id);
+    USLOSS_Console("Setter(): EventFree returned %d\n", result);
+
+    quit(9);
+}
@@ -0,0 +1,118 @@
+
+/* Broadcast mailboxes.  Two fast subscribers get every message, straight
+ * from the sender since they are blocked waiting for it.  A slow subscriber
+ * reads nothing for a while, so its unread messages fill the mailbox's two
+ * slots and the third send blocks.  Once it reads one message the sender
+ * gets through; when it unsubscribes, its references to the rest are
+ * dropped and the mailbox empties.  Finally the mailbox is released while
+ * the fast subscribers are blocked, and both get -3.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Fast(char *);
+int Slow(char *);
+int Sender(char *);
+int Kicker(char *);
+
+int mbox_id;
+int sem_id;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    mbox_id = MboxCreateBroadcast(2, 20);
+    sem_id = SemCreate(0);
+
+    fork1("FastA",  Fast,   "FastA", 2 * USLOSS_MIN_STACK, 2);
+    fork1("FastB",  Fast,   "FastB", 2 * USLOSS_MIN_STACK, 2);
+    fork1("Slow",   Slow,   NULL,    2 * USLOSS_MIN_STACK, 2);
+    fork1("Sender", Sender, NULL,    2 * USLOSS_MIN_STACK, 3);
+    fork1("Kicker", Kicker, NULL,    2 * USLOSS_MIN_STACK, 4);
+
+    for (i = 0; i < 5; i++) {
+        join(&kid_status);
+    }
+    USLOSS_Console("start2(): all done\n");
+
+    quit(0);
+}
+
+int Fast(char *arg)
+{
+    char buf[20];
+    int result;
+
+    USLOSS_Console("%s(): MboxSubscribe returned %d\n", arg, MboxSubscribe(mbox_id));
+    for (;;) {
+        result = MboxRecv(mbox_id, buf, sizeof(buf));
+        if (result < 0) {
+            break;
+        }
+        USLOSS_Console("%s(): received '%s'\n", arg, buf);
+    }
+    USLOSS_Console("%s(): MboxRecv returned %d\n", arg, result);
+
+    quit(1);
+}
+
+int Slow(char *arg)
+{
+    char buf[20];
+    MboxStatsInfo stats;
+    int result;
+
+    USLOSS_Console("Slow(): MboxSubscribe returned %d\n", MboxSubscribe(mbox_id));
+    SemP(sem_id);
+
+    result = MboxRecv(mbox_id, buf, sizeof(buf));
+    USLOSS_Console("Slow(): received %d bytes, '%s'\n", result, buf);
+
+    MboxStats(mbox_id, &stats);
+    USLOSS_Console("Slow(): %d messages queued before unsubscribing\n", stats.depth);
+    result = MboxUnsubscribe(mbox_id);
+    USLOSS_Console("Slow(): MboxUnsubscribe returned %d\n", result);
+    MboxStats(mbox_id, &stats);
+    USLOSS_Console("Slow(): %d messages queued after unsubscribing\n", stats.depth);
+
+    quit(2);
+}
+
+int Sender(char *arg)
+{
+    char buf[20];
+    int i, result;
+
+    for (i = 1; i <= 3; i++) {
+        sprintf(buf, "message %d", i);
+        USLOSS_Console("Sender(): sending '%s'\n", buf);
+        result = MboxSend(mbox_id, buf, 10);
+        USLOSS_Console("Sender(): MboxSend returned %d\n", result);
+    }
+
+    quit(3);
+}
+
+int Kicker(char *arg)
+{
+    MboxStatsInfo stats;
+    int result;
+
+    MboxStats(mbox_id, &stats);
+    USLOSS_Console("Kicker(): %d messages queued, %d sends blocked; waking Slow\n",
+                   stats.depth, stats.blockedSends);
+    SemV(sem_id);
+
+    USLOSS_Console("Kicker(): releasing the mailbox\n");
+    result = MboxRelease(mbox_id);
+    USLOSS_Console("Kicker(): MboxRelease returned %d\n", result);
+
+    quit(4);
+}
@@ -0,0 +1,84 @@
+
+/* Topics.  Four mailboxes subscribe to one topic: one with a receiver
+ * blocked on it, one with room, one whose slots are too small for the
+ * message, and one that is already full.  The waiting receiver is handed
+ * the message directly, the mailbox with room queues it, and the other two
+ * count a drop.  A publish stores the payload once: each queue only holds
+ * a slot referring to it, which MboxDump() shows in the slot count.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Receiver(char *);
+int Publisher(char *);
+
+int topic_id;
+int waiting_box, roomy_box, small_box, full_box;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    topic_id = TopicCreate("weather");
+    waiting_box = MboxCreate(2, 50);
+    roomy_box = MboxCreate(2, 50);
+    small_box = MboxCreate(2, 4);
+    full_box = MboxCreate(1, 50);
+    MboxSend(full_box, "old", 4);
+
+    TopicSubscribe(topic_id, waiting_box);
+    TopicSubscribe(topic_id, roomy_box);
+    TopicSubscribe(topic_id, small_box);
+    TopicSubscribe(topic_id, full_box);
+
+    fork1("Receiver",  Receiver,  NULL, 2 * USLOSS_MIN_STACK, 2);
+    fork1("Publisher", Publisher, NULL, 2 * USLOSS_MIN_STACK, 3);
+    for (i = 0; i < 2; i++) {
+        join(&kid_status);
+    }
+
+    quit(0);
+}
+
+int Receiver(char *arg)
+{
+    char buf[50];
+    int result;
+
+    USLOSS_Console("Receiver(): blocking on the first mailbox\n");
+    result = MboxRecv(waiting_box, buf, sizeof(buf));
+    USLOSS_Console("Receiver(): MboxRecv returned %d, '%s'\n", result, buf);
+
+    quit(1);
+}
+
+int Publisher(char *arg)
+{
+    char buf[50];
+    int result;
+
+    result = TopicPublish(topic_id, "sunny", 6);
+    USLOSS_Console("Publisher(): first TopicPublish returned %d\n", result);
+    result = TopicPublish(topic_id, "rain", 5);
+    USLOSS_Console("Publisher(): second TopicPublish returned %d\n", result);
+
+    USLOSS_Console("Publisher(): drops: waiting %d, roomy %d, small %d, full %d\n",
+                   TopicDrops(topic_id, waiting_box), TopicDrops(topic_id, roomy_box),
+                   TopicDrops(topic_id, small_box), TopicDrops(topic_id, full_box));
+    MboxDump();
+
+    result = MboxRecv(roomy_box, buf, sizeof(buf));
+    USLOSS_Console("Publisher(): roomy mailbox: %d, '%s'\n", result, buf);
+    result = MboxRecv(roomy_box, buf, sizeof(buf));
+    USLOSS_Console("Publisher(): roomy mailbox: %d, '%s'\n", result, buf);
+    result = MboxRecv(waiting_box, buf, sizeof(buf));
+    USLOSS_Console("Publisher(): first mailbox: %d, '%s'\n", result, buf);
+
+    quit(2);
+}
@@ -0,0 +1,66 @@
+
+/* Priority lanes.  Messages sent to a three-lane mailbox in mixed lane
+ * order come out highest lane first, and in the order they were sent
+ * within a lane; a plain MboxSend() goes to lane 0.  A message sent to a
+ * higher lane while lower ones are queued is received next.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int mbox_id;
+
+void Send(int lane, char *msg);
+void Recv(void);
+
+
+
+int start2(char *arg)
+{
+    int result;
+
+    USLOSS_Console("start2(): started\n");
+    result = MboxCreatePrio(4, 20, 0);
+    USLOSS_Console("start2(): MboxCreatePrio with 0 lanes returned %d\n", result);
+    result = MboxCreatePrio(4, 20, MBOX_MAX_LANES + 1);
+    USLOSS_Console("start2(): MboxCreatePrio with too many lanes returned %d\n", result);
+
+    mbox_id = MboxCreatePrio(8, 20, 3);
+    result = MboxSendPrio(mbox_id, "bad", 4, 3);
+    USLOSS_Console("start2(): MboxSendPrio to lane 3 returned %d\n", result);
+
+    Send(0, "lane 0, first");
+    Send(2, "lane 2, first");
+    Send(1, "lane 1, first");
+    Send(0, "lane 0, second");
+    Send(2, "lane 2, second");
+    USLOSS_Console("start2(): MboxSend of 'lane 0, third' returned %d\n",
+                   MboxSend(mbox_id, "lane 0, third", 14));
+
+    Recv();
+    Recv();
+    Send(2, "lane 2, third");
+    Recv();
+    Recv();
+    Recv();
+    Recv();
+    Recv();
+
+    quit(0);
+}
+
+void Send(int lane, char *msg)
+{
+    int result = MboxSendPrio(mbox_id, msg, strlen(msg) + 1, lane);
+    USLOSS_Console("start2(): MboxSendPrio of '%s' returned %d\n", msg, result);
+}
+
+void Recv(void)
+{
+    char buf[20];
+    int result = MboxCondRecv(mbox_id, buf, sizeof(buf));
+    USLOSS_Console("start2(): received %d bytes, '%s'\n", result, buf);
+}
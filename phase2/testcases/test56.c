@@ -0,0 +1,104 @@
+
+/* Splice links.  A tag filter and then a size filter decide which sends to
+ * mailbox A are delivered to B, with the rest staying in A; a second link
+ * from B to C makes a chain.  Links that would close a loop are rejected,
+ * and releasing B removes A's link to it.  Finally A is linked to C while C
+ * is full: a conditional send or forward that fails there is not counted
+ * in A's spliced statistic, and one that gets through is.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int box_a, box_b, box_c;
+
+void Send(int tag, char *msg);
+void Drain(char *name, int mbox_id);
+int Spliced(int mbox_id);
+
+
+
+int start2(char *arg)
+{
+    char buf[50];
+    int result, box_d;
+
+    USLOSS_Console("start2(): started\n");
+    box_a = MboxCreate(4, 50);
+    box_b = MboxCreate(4, 50);
+    box_c = MboxCreate(4, 50);
+
+    USLOSS_Console("start2(): splicing A to B for tag 3: %d\n", MboxSplice(box_a, box_b, 3, -1));
+    Send(3, "tag 3");
+    Send(0, "tag 0");
+    Drain("A", box_a);
+    Drain("B", box_b);
+
+    USLOSS_Console("start2(): splicing A to B for up to 8 bytes: %d\n",
+                   MboxSplice(box_a, box_b, -1, 8));
+    Send(5, "short");
+    Send(0, "a longer message");
+    Drain("A", box_a);
+    Drain("B", box_b);
+
+    USLOSS_Console("start2(): splicing B to C: %d\n", MboxSplice(box_b, box_c, -1, -1));
+    Send(0, "chained");
+    Drain("B", box_b);
+    Drain("C", box_c);
+
+    result = MboxSplice(box_c, box_a, -1, -1);
+    USLOSS_Console("start2(): splicing C to A returned %d\n", result);
+    result = MboxSplice(box_a, box_a, -1, -1);
+    USLOSS_Console("start2(): splicing A to itself returned %d\n", result);
+
+    USLOSS_Console("start2(): releasing B: %d\n", MboxRelease(box_b));
+    Send(0, "after");
+    Drain("A", box_a);
+    result = MboxUnsplice(box_a);
+    USLOSS_Console("start2(): MboxUnsplice on A returned %d\n", result);
+
+    box_d = MboxCreate(1, 50);
+    MboxSend(box_d, "forward me", 11);
+    USLOSS_Console("start2(): splicing A to C: %d\n", MboxSplice(box_a, box_c, -1, -1));
+    while (MboxCondSend(box_c, "filler", 7) == 0) {
+    }
+    USLOSS_Console("start2(): A has spliced %d message(s)\n", Spliced(box_a));
+    result = MboxCondSend(box_a, "no room", 8);
+    USLOSS_Console("start2(): MboxCondSend to A with C full returned %d\n", result);
+    result = MboxCondForward(box_d, box_a);
+    USLOSS_Console("start2(): MboxCondForward to A with C full returned %d\n", result);
+    USLOSS_Console("start2(): A has spliced %d message(s)\n", Spliced(box_a));
+
+    MboxRecv(box_c, buf, sizeof(buf));
+    result = MboxCondForward(box_d, box_a);
+    USLOSS_Console("start2(): MboxCondForward to A with room in C returned %d\n", result);
+    USLOSS_Console("start2(): A has spliced %d message(s)\n", Spliced(box_a));
+
+    quit(0);
+}
+
+void Send(int tag, char *msg)
+{
+    int result = MboxSendTag(box_a, msg, strlen(msg) + 1, tag);
+    USLOSS_Console("start2(): sent '%s' with tag %d to A: %d\n", msg, tag, result);
+}
+
+void Drain(char *name, int mbox_id)
+{
+    char buf[50];
+
+    while (MboxCondRecv(mbox_id, buf, sizeof(buf)) >= 0) {
+        USLOSS_Console("start2():     %s had '%s'\n", name, buf);
+    }
+}
+
+int Spliced(int mbox_id)
+{
+    MboxStatsInfo stats;
+
+    MboxStats(mbox_id, &stats);
+    return stats.spliced;
+}
@@ -0,0 +1,70 @@
+
+/* MboxSetWakePolicy() while receivers are blocked.  Two receivers block on
+ * a MBOX_WAKE_PRIORITY mailbox, the worse priority first; the mailbox is
+ * then switched to MBOX_WAKE_FIFO and a third receiver blocks.  All three
+ * must be woken in the order they arrived.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Receiver(char *);
+int Controller(char *);
+
+int mbox_id;
+
+
+
+int start2(char *arg)
+{
+    int i, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    mbox_id = MboxCreate(4, 10);
+    USLOSS_Console("start2(): MboxSetWakePolicy(PRIORITY) returned %d\n",
+                   MboxSetWakePolicy(mbox_id, MBOX_WAKE_PRIORITY));
+
+    fork1("First",      Receiver,   "3", 2 * USLOSS_MIN_STACK, 2);
+    fork1("Second",     Receiver,   "1", 2 * USLOSS_MIN_STACK, 2);
+    fork1("Controller", Controller, NULL, 2 * USLOSS_MIN_STACK, 4);
+
+    for (i = 0; i < 3; i++) {
+        join(&kid_status);
+    }
+
+    quit(0);
+}
+
+int Receiver(char *arg)
+{
+    char buf[10];
+    int priority = arg[0] - '0';
+    int result;
+
+    MboxSetPriority(priority);
+    USLOSS_Console("Receiver(): priority %d blocking\n", priority);
+    result = MboxRecv(mbox_id, buf, sizeof(buf));
+    USLOSS_Console("Receiver(): priority %d got '%s' (%d)\n", priority, buf, result);
+
+    quit(priority);
+}
+
+int Controller(char *arg)
+{
+    int i, kid_status, result;
+
+    result = MboxSetWakePolicy(mbox_id, MBOX_WAKE_FIFO);
+    USLOSS_Console("Controller(): MboxSetWakePolicy(FIFO) returned %d\n", result);
+    fork1("Third", Receiver, "5", 2 * USLOSS_MIN_STACK, 2);
+
+    for (i = 0; i < 3; i++) {
+        char msg[10];
+        sprintf(msg, "msg %d", i + 1);
+        MboxSend(mbox_id, msg, 6);
+    }
+    join(&kid_status);
+
+    quit(9);
+}
@@ -0,0 +1,56 @@
+/* Topics and released mailboxes.  Two mailboxes subscribe to a topic, then
+ * one is released and a new mailbox is created, which reuses its id.  The
+ * new mailbox never subscribed, so a publish must reach only the mailbox
+ * that is still subscribed, and nothing may arrive in the new one.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+
+
+int start2(char *arg)
+{
+    char buf[50];
+    int topic_id, kept_box, gone_box, new_box, result;
+
+    USLOSS_Console("start2(): started\n");
+    topic_id = TopicCreate("news");
+    kept_box = MboxCreate(2, 50);
+    gone_box = MboxCreate(2, 50);
+
+    result = TopicSubscribe(topic_id, kept_box);
+    USLOSS_Console("start2(): TopicSubscribe returned %d\n", result);
+    result = TopicSubscribe(topic_id, gone_box);
+    USLOSS_Console("start2(): TopicSubscribe returned %d\n", result);
+
+    result = MboxRelease(gone_box);
+    USLOSS_Console("start2(): MboxRelease returned %d\n", result);
+    new_box = MboxCreate(2, 50);
+    USLOSS_Console("start2(): MboxCreate reused the released id: %s\n",
+                   new_box == gone_box ? "yes" : "no");
+
+    result = TopicDrops(topic_id, new_box);
+    USLOSS_Console("start2(): TopicDrops on the new mailbox returned %d\n", result);
+
+    result = TopicPublish(topic_id, "leak", 5);
+    USLOSS_Console("start2(): TopicPublish returned %d\n", result);
+
+    result = MboxCondRecv(new_box, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxCondRecv on the new mailbox returned %d\n", result);
+    result = MboxCondRecv(kept_box, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxCondRecv on the kept mailbox returned %d, '%s'\n",
+                   result, buf);
+
+    result = TopicSubscribe(topic_id, new_box);
+    USLOSS_Console("start2(): TopicSubscribe on the new mailbox returned %d\n", result);
+    result = TopicPublish(topic_id, "news", 5);
+    USLOSS_Console("start2(): TopicPublish returned %d\n", result);
+    result = MboxCondRecv(new_box, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxCondRecv on the new mailbox returned %d, '%s'\n",
+                   result, buf);
+
+    quit(0);
+}
@@ -0,0 +1,93 @@
+/* Selective receive by tag.  start2 sends tags 1, 2, 1 and receives tag 1
+ * twice, then tag 2; each tag must come out in the order it was sent.  A
+ * negative tag is refused with -1.
+ *
+ * Then the mailbox is filled with tag 2 messages and two senders block on
+ * it, the first with a tag 1 message.  A receiver asking for tag 1 must get
+ * that message from the blocked sender rather than wait, and a later tag 1
+ * message, sent once the receiver asks again, must come after it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int SenderTag(char *);
+int Waiter(char *);
+
+int mbox_id;
+
+
+
+int start2(char *arg)
+{
+    char buf[50];
+    int i, result, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    mbox_id = MboxCreate(4, 50);
+
+    MboxSendTag(mbox_id, "t1-a", 5, 1);
+    MboxSendTag(mbox_id, "t2-a", 5, 2);
+    MboxSendTag(mbox_id, "t1-b", 5, 1);
+
+    result = MboxRecvTag(mbox_id, -5, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxRecvTag with tag -5 returned %d\n", result);
+
+    result = MboxRecvTag(mbox_id, 1, buf, sizeof(buf));
+    USLOSS_Console("start2(): tag 1: %d, '%s'\n", result, buf);
+    result = MboxRecvTag(mbox_id, 1, buf, sizeof(buf));
+    USLOSS_Console("start2(): tag 1: %d, '%s'\n", result, buf);
+    result = MboxRecvTag(mbox_id, 2, buf, sizeof(buf));
+    USLOSS_Console("start2(): tag 2: %d, '%s'\n", result, buf);
+    result = MboxCondRecv(mbox_id, buf, sizeof(buf));
+    USLOSS_Console("start2(): MboxCondRecv on the empty mailbox returned %d\n", result);
+    MboxRelease(mbox_id);
+
+    mbox_id = MboxCreate(2, 50);
+    MboxSendTag(mbox_id, "fill-a", 7, 2);
+    MboxSendTag(mbox_id, "fill-b", 7, 2);
+
+    fork1("SenderOld", SenderTag, "1old", 2 * USLOSS_MIN_STACK, 3);
+    fork1("SenderMid", SenderTag, "2mid", 2 * USLOSS_MIN_STACK, 3);
+    fork1("Waiter",    Waiter,    NULL,   2 * USLOSS_MIN_STACK, 3);
+    fork1("SenderNew", SenderTag, "1new", 2 * USLOSS_MIN_STACK, 3);
+
+    for (i = 0; i < 4; i++) {
+        join(&kid_status);
+    }
+
+    quit(0);
+}
+
+/* arg is the tag digit followed by the message */
+int SenderTag(char *arg)
+{
+    int result;
+
+    USLOSS_Console("SenderTag(): sending '%s' with tag %c\n", arg + 1, arg[0]);
+    result = MboxSendTag(mbox_id, arg + 1, strlen(arg), arg[0] - '0');
+    USLOSS_Console("SenderTag(): '%s' sent, result %d\n", arg + 1, result);
+
+    quit(1);
+}
+
+int Waiter(char *arg)
+{
+    char buf[50];
+    int i, result;
+
+    result = MboxRecvTag(mbox_id, 1, buf, sizeof(buf));
+    USLOSS_Console("Waiter(): tag 1: %d, '%s'\n", result, buf);
+    result = MboxRecvTag(mbox_id, 1, buf, sizeof(buf));
+    USLOSS_Console("Waiter(): tag 1: %d, '%s'\n", result, buf);
+
+    for (i = 0; i < 3; i++) {
+        result = MboxRecv(mbox_id, buf, sizeof(buf));
+        USLOSS_Console("Waiter(): any tag: %d, '%s'\n", result, buf);
+    }
+
+    quit(2);
+}
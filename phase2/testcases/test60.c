@@ -0,0 +1,93 @@
+/* Loaned receives.  MboxRecvLoan() lends out a queued message in place, a
+ * message copied into a fresh slot because it went straight from a sender
+ * to the blocked receiver, and a topic publish, whose one shared payload
+ * is lent to both subscriber mailboxes.  MboxDump() shows the lent slots
+ * still in use, and none once every loan is returned.  Returning a loan
+ * twice, or something that is not a loan, gives -1; a zero-length message
+ * lends no slot at all.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Sender(char *);
+
+int mbox_id;
+
+
+
+int start2(char *arg)
+{
+    void *queued, *direct, *shared_a, *shared_b, *empty;
+    char buf[10];
+    int topic_id, box_a, box_b, result, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    mbox_id = MboxCreate(3, 50);
+
+    MboxSend(mbox_id, "queued", 7);
+    result = MboxRecvLoan(mbox_id, &queued);
+    USLOSS_Console("start2(): queued loan: %d, '%s'\n", result, (char *)queued);
+
+    fork1("Sender", Sender, NULL, 2 * USLOSS_MIN_STACK, 3);
+    result = MboxRecvLoan(mbox_id, &direct);
+    USLOSS_Console("start2(): direct loan: %d, '%s'\n", result, (char *)direct);
+
+    topic_id = TopicCreate("loans");
+    box_a = MboxCreate(2, 50);
+    box_b = MboxCreate(2, 50);
+    TopicSubscribe(topic_id, box_a);
+    TopicSubscribe(topic_id, box_b);
+    result = TopicPublish(topic_id, "shared", 7);
+    USLOSS_Console("start2(): TopicPublish returned %d\n", result);
+    result = MboxRecvLoan(box_a, &shared_a);
+    USLOSS_Console("start2(): first topic loan: %d, '%s'\n", result, (char *)shared_a);
+    result = MboxRecvLoan(box_b, &shared_b);
+    USLOSS_Console("start2(): second topic loan: %d, '%s'\n", result, (char *)shared_b);
+    USLOSS_Console("start2(): both topic loans share the payload: %s\n",
+                   shared_a == shared_b ? "yes" : "no");
+
+    MboxDump();
+
+    result = MboxReturnLoan(queued);
+    USLOSS_Console("start2(): MboxReturnLoan of the queued loan returned %d\n", result);
+    result = MboxReturnLoan(queued);
+    USLOSS_Console("start2(): MboxReturnLoan of it again returned %d\n", result);
+    result = MboxReturnLoan(direct);
+    USLOSS_Console("start2(): MboxReturnLoan of the direct loan returned %d\n", result);
+    result = MboxReturnLoan(shared_a);
+    USLOSS_Console("start2(): MboxReturnLoan of the first topic loan returned %d\n", result);
+    result = MboxReturnLoan(shared_b);
+    USLOSS_Console("start2(): MboxReturnLoan of the second topic loan returned %d\n", result);
+    result = MboxReturnLoan(shared_b);
+    USLOSS_Console("start2(): MboxReturnLoan of the payload a third time returned %d\n", result);
+    result = MboxReturnLoan(buf);
+    USLOSS_Console("start2(): MboxReturnLoan of a local buffer returned %d\n", result);
+
+    MboxDump();
+
+    MboxSend(mbox_id, NULL, 0);
+    result = MboxRecvLoan(mbox_id, &empty);
+    USLOSS_Console("start2(): zero-length loan: %d, pointer is NULL: %s\n", result,
+                   empty == NULL ? "yes" : "no");
+    result = MboxReturnLoan(empty);
+    USLOSS_Console("start2(): MboxReturnLoan of NULL returned %d\n", result);
+
+    join(&kid_status);
+    USLOSS_Console("start2(): joined with the sender, status = %d\n", kid_status);
+
+    quit(0);
+}
+
+int Sender(char *arg)
+{
+    int result;
+
+    USLOSS_Console("Sender(): sending to the blocked receiver\n");
+    result = MboxSend(mbox_id, "direct", 7);
+    USLOSS_Console("Sender(): MboxSend returned %d\n", result);
+
+    quit(3);
+}
@@ -0,0 +1,103 @@
+/* Priority inversion on a zero-slot mailbox.  Low (declared priority 5)
+ * receives once from the zero-slot mailbox, which makes it the receiver
+ * that High (declared priority 1) is stuck behind when High sends to it
+ * next.  That is counted as an inversion, and High lends Low priority 1.
+ *
+ * Low then waits on a MBOX_WAKE_PRIORITY mailbox where Mid (declared
+ * priority 3) has been waiting longer.  With the lent priority Low goes
+ * first and gets the first message there; without it Mid would.  The
+ * children only record what they got, and start2 prints it at the end, so
+ * the output doesn't depend on whether phase 1 runs Low at the priority it
+ * was lent.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+int Low(char *);
+int Driver(char *);
+int Mid(char *);
+int High(char *);
+
+int zero_box, prio_box, sem_id;
+char low_got[20], mid_got[20], urgent_got[20];
+int high_result;
+
+
+
+int start2(char *arg)
+{
+    MboxStatsInfo stats;
+    int i, kid_status;
+
+    USLOSS_Console("start2(): started\n");
+    zero_box = MboxCreate(0, 20);
+    prio_box = MboxCreate(2, 20);
+    MboxSetWakePolicy(prio_box, MBOX_WAKE_PRIORITY);
+    sem_id = SemCreate(0);
+
+    fork1("Low",    Low,    NULL, 2 * USLOSS_MIN_STACK, 3);
+    fork1("Driver", Driver, NULL, 2 * USLOSS_MIN_STACK, 3);
+    fork1("Mid",    Mid,    NULL, 2 * USLOSS_MIN_STACK, 3);
+    fork1("High",   High,   NULL, 2 * USLOSS_MIN_STACK, 3);
+    for (i = 0; i < 4; i++) {
+        join(&kid_status);
+    }
+
+    USLOSS_Console("start2(): Low got '%s' from the priority mailbox\n", low_got);
+    USLOSS_Console("start2(): Mid got '%s' from the priority mailbox\n", mid_got);
+    USLOSS_Console("start2(): Low got '%s' from High, whose MboxSend returned %d\n",
+                   urgent_got, high_result);
+
+    MboxStats(zero_box, &stats);
+    USLOSS_Console("start2(): zero-slot mailbox: %d inversion(s), %d blocked send(s)\n",
+                   stats.inversions, stats.blockedSends);
+    MboxStats(prio_box, &stats);
+    USLOSS_Console("start2(): priority mailbox: %d inversion(s)\n", stats.inversions);
+
+    quit(0);
+}
+
+int Low(char *arg)
+{
+    char buf[20];
+
+    MboxSetPriority(5);
+    MboxRecv(zero_box, buf, sizeof(buf));
+
+    // High is blocked on zero_box by now, lending us its priority
+    SemV(sem_id);
+    MboxRecv(prio_box, low_got, sizeof(low_got));
+    MboxRecv(zero_box, urgent_got, sizeof(urgent_got));
+
+    quit(1);
+}
+
+int Driver(char *arg)
+{
+    MboxSend(zero_box, "warm-up", 8);
+    SemP(sem_id);
+    MboxSend(prio_box, "first", 6);
+    MboxSend(prio_box, "second", 7);
+
+    quit(2);
+}
+
+int Mid(char *arg)
+{
+    MboxSetPriority(3);
+    MboxRecv(prio_box, mid_got, sizeof(mid_got));
+
+    quit(3);
+}
+
+int High(char *arg)
+{
+    MboxSetPriority(1);
+    high_result = MboxSend(zero_box, "urgent", 7);
+
+    quit(4);
+}
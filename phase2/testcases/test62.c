@@ -0,0 +1,47 @@
+/* MboxLatencyPercentile().  The histogram is filled in by hand, the way
+ * 100 deliveries with known waits would fill it: 90 with no wait (bucket
+ * 0), 9 that waited 5 us (bucket 3, up to 7 us) and one that waited 1000 us
+ * (bucket 10, up to 1023 us).  Each percentile is the upper bound of the
+ * first bucket that reaches it, so p50 and p90 are 0, p91 and p99 are 7 us
+ * and only p100 sees the slow delivery.  A histogram with no samples, and
+ * percentiles outside 0 through 100, give -1.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+
+
+int start2(char *arg)
+{
+    MboxStatsInfo stats;
+    int percents[] = { 0, 50, 90, 91, 99, 100 };
+    int i;
+
+    USLOSS_Console("start2(): started\n");
+
+    memset(&stats, 0, sizeof(stats));
+    USLOSS_Console("start2(): p50 of an empty histogram: %d\n",
+                   MboxLatencyPercentile(&stats, 50));
+
+    stats.latency[0] = 90;
+    stats.latency[3] = 9;
+    stats.latency[10] = 1;
+    for (i = 0; i < sizeof(percents) / sizeof(percents[0]); i++) {
+        USLOSS_Console("start2(): p%d = %d us\n", percents[i],
+                       MboxLatencyPercentile(&stats, percents[i]));
+    }
+    USLOSS_Console("start2(): p-1 = %d, p101 = %d\n",
+                   MboxLatencyPercentile(&stats, -1), MboxLatencyPercentile(&stats, 101));
+
+    // a single sample is every percentile
+    memset(&stats, 0, sizeof(stats));
+    stats.latency[1] = 1;
+    USLOSS_Console("start2(): one 1 us wait: p50 = %d us, p99 = %d us\n",
+                   MboxLatencyPercentile(&stats, 50), MboxLatencyPercentile(&stats, 99));
+
+    quit(0);
+}
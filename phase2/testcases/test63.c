@@ -0,0 +1,116 @@
+/* TraceRead().  A mailbox is created, sent to twice and received from
+ * once, then released; the mailbox records TraceRead hands back must be
+ * those five, oldest first.  Clock ticks and interrupts can land anywhere
+ * in the ring, so only the create/send/recv/release records are looked at.
+ *
+ * Then 3000 send/receive pairs, 6000 records, overflow the ring.  The send
+ * sizes count up modulo 100, so the records still in the ring must all be
+ * newer than the first mailbox, follow each other without a gap and end
+ * with the last pair sent.  A read of fewer records than the ring holds
+ * returns the newest ones.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+
+#define PAIRS 3000
+
+int isMboxOp(TraceRecord *rec);
+
+TraceRecord ring[TRACE_RING_SIZE];
+TraceRecord tail[10];
+char *opNames[] = { "create", "send", "recv", "release" };
+
+
+
+int start2(char *arg)
+{
+    char buf[100];
+    int mbox_id, flood_id, count, i, found;
+    int sends, gaps, stale, expected;
+    TraceRecord *last;
+
+    USLOSS_Console("start2(): started\n");
+
+    // created first, so that it can't reuse the id of the released mailbox
+    flood_id = MboxCreate(1, 100);
+    mbox_id = MboxCreate(5, 50);
+    MboxCondSend(mbox_id, "hello", 6);
+    MboxCondSend(mbox_id, "hi", 3);
+    MboxCondRecv(mbox_id, buf, sizeof(buf));
+    MboxRelease(mbox_id);
+
+    count = TraceRead(ring, TRACE_RING_SIZE);
+    USLOSS_Console("start2(): ring not yet full: %s\n",
+                   count < TRACE_RING_SIZE ? "yes" : "no");
+
+    // the last five mailbox records, oldest first
+    found = 0;
+    for (i = count - 1; i >= 0 && found < 5; i--) {
+        if (isMboxOp(&ring[i])) {
+            found++;
+        }
+    }
+    for (i++; i < count; i++) {
+        if (isMboxOp(&ring[i])) {
+            USLOSS_Console("start2(): %-7s mbox %s, size %d\n", opNames[ring[i].op],
+                           ring[i].id == mbox_id ? "first" : "other", ring[i].size);
+        }
+    }
+
+    for (i = 0; i < PAIRS; i++) {
+        MboxCondSend(flood_id, buf, i % 100);
+        MboxCondRecv(flood_id, buf, sizeof(buf));
+    }
+
+    count = TraceRead(ring, TRACE_RING_SIZE);
+    USLOSS_Console("start2(): ring full after %d pairs: %s\n", PAIRS,
+                   count == TRACE_RING_SIZE ? "yes" : "no");
+
+    // every send still in the ring follows the one before it
+    sends = 0;
+    gaps = 0;
+    stale = 0;
+    expected = -1;
+    last = NULL;
+    for (i = 0; i < count; i++) {
+        if (!isMboxOp(&ring[i])) {
+            continue;
+        }
+        if (ring[i].id != flood_id) {
+            stale++;
+            continue;
+        }
+        if (ring[i].op == TRACE_SEND) {
+            if (expected >= 0 && ring[i].size != expected) {
+                gaps++;
+            }
+            expected = (ring[i].size + 1) % 100;
+            sends++;
+        }
+        last = &ring[i];
+    }
+    USLOSS_Console("start2(): records of the first mailbox left: %d\n", stale);
+    USLOSS_Console("start2(): sends left in the ring: %s, out of order: %d\n",
+                   sends > 0 && sends < PAIRS ? "some" : "wrong count", gaps);
+    USLOSS_Console("start2(): newest record: %s of size %d\n",
+                   last ? opNames[last->op] : "none", last ? last->size : -1);
+
+    // a short read is the tail of a full one
+    found = TraceRead(tail, 10);
+    for (i = found - 1; i >= 0 && !isMboxOp(&tail[i]); i--)
+        ;
+    USLOSS_Console("start2(): short read returned %d records, ending with the newest: %s\n",
+                   found, i >= 0 && last && tail[i].op == last->op &&
+                   tail[i].size == last->size ? "yes" : "no");
+
+    MboxRelease(flood_id);
+    return 0;
+}
+
+int isMboxOp(TraceRecord *rec)
+{
+    return rec->op <= TRACE_RELEASE;
+}